@@ -0,0 +1,321 @@
+#!/usr/bin/env node
+
+// Local stand-in for the parts of workflowy.com the CLI talks to, for repeatable end-to-end runs.
+// Serves get_tree_data, get_initialization_data, push_and_poll and api/bullets/create from a fixture tree kept
+// in memory, with optional shared trees, latency and injected failures. Prints "listening on <url>" once it accepts requests;
+// point the CLI at that url through WORKFLOWY_API_BASE.
+
+import { fileURLToPath } from 'url';
+import crypto from "crypto";
+import http from "http";
+import path from 'path';
+import fs from "fs";
+
+const __filename = fileURLToPath(import.meta.url);
+const __dirname = path.dirname(__filename);
+
+function usage() {
+  console.error(`
+Usage:
+  fake-workflowy-server.js [options]
+
+Options:
+  --port <n>          Port to listen on, 0 for any free one (default 0)
+  --fixture <path>    Tree to serve, nested like get_tree_data returns it (default ../src/tree_data.json)
+  --shares <n>        Also share n trees with the account, each a copy of the fixture under one project with
+                      fresh ids, mounted at the end of the main tree (default 0)
+  --revoked <n>       Of those, the last n are still listed by get_initialization_data but can no longer be read
+                      or polled, like shares revoked in between (default 0)
+  --latency <ms>      Delay before every response (default 0)
+  --jitter <ms>       Extra random delay of up to this much (default 0)
+  --fail-rate <p>     Share of requests answered with HTTP 500, 0 to 1 (default 0)
+  --fail-paths <a,b>  Only inject failures on these endpoints, e.g. push_and_poll
+`);
+  process.exit(1);
+}
+
+function parseOptions(argv) {
+  const options = {
+    port: 0,
+    fixture: path.join(__dirname, '..', 'src', 'tree_data.json'),
+    shares: 0,
+    revoked: 0,
+    latency: 0,
+    jitter: 0,
+    failRate: 0,
+    failPaths: null,
+  };
+
+  for (let i = 0; i < argv.length; i++) {
+    const value = argv[i + 1];
+    switch (argv[i]) {
+      case '--port': options.port = Number(value); i++; break;
+      case '--fixture': options.fixture = value; i++; break;
+      case '--shares': options.shares = Number(value); i++; break;
+      case '--revoked': options.revoked = Number(value); i++; break;
+      case '--latency': options.latency = Number(value); i++; break;
+      case '--jitter': options.jitter = Number(value); i++; break;
+      case '--fail-rate': options.failRate = Number(value); i++; break;
+      case '--fail-paths': options.failPaths = new Set(value.split(',')); i++; break;
+      default: usage();
+    }
+  }
+  return options;
+}
+
+// One project tree: flat items keyed by id, as get_tree_data sends them, plus every transaction so far
+class FakeTree {
+  constructor(fixture, timestamp) {
+    this.timestamp = timestamp;
+    this.items = new Map();
+    this.transactions = [];
+    this.transactionId = 1000;
+    this.flatten(fixture, null);
+  }
+
+  flatten(nodes, parentId) {
+    for (const node of nodes ?? []) {
+      const { children, ...item } = node;
+      this.items.set(item.id, { ...item, prnt: parentId });
+      this.flatten(children, item.id);
+    }
+  }
+
+  treeData() {
+    return { items: [...this.items.values()] };
+  }
+
+  // Run one payload entry's operations all or nothing, and report what was committed since its transaction
+  pushAndPoll(entry) {
+    const { most_recent_operation_transaction_id: since, operations = [] } = entry ?? {};
+    const concurrent = this.transactions
+      .filter(transaction => transaction.id > Number(since))
+      .map(transaction => JSON.stringify({ ops: transaction.ops }));
+
+    const result = {
+      concurrent_remote_operation_transactions: concurrent,
+      error_encountered_in_remote_operations: false,
+      new_most_recent_operation_transaction_id: String(this.transactionId),
+    };
+
+    if (operations.length === 0) {
+      return result;
+    }
+
+    const snapshot = new Map([...this.items].map(([id, item]) => [id, { ...item }]));
+    try {
+      for (const operation of operations) {
+        this.apply(operation);
+      }
+    } catch (err) {
+      this.items = snapshot;
+      result.error_encountered_in_remote_operations = true;
+      result.error = err.message;
+      return result;
+    }
+
+    this.transactionId++;
+    this.transactions.push({ id: this.transactionId, ops: operations });
+    result.new_most_recent_operation_transaction_id = String(this.transactionId);
+    result.server_run_operation_transaction_json = JSON.stringify({ id: this.transactionId, ops: operations });
+    return result;
+  }
+
+  apply(operation) {
+    const data = operation.data ?? {};
+    const item = this.items.get(data.projectid);
+    const needItem = () => {
+      if (!item) throw new Error(`No such project: ${data.projectid}`);
+    };
+
+    switch (operation.type) {
+      case 'edit':
+        needItem();
+        item.nm = data.name ?? item.nm;
+        item.lm = this.timestamp();
+        break;
+      case 'complete':
+        needItem();
+        item.cp = this.timestamp();
+        break;
+      case 'uncomplete':
+        needItem();
+        delete item.cp;
+        break;
+      case 'delete':
+        needItem();
+        this.remove(data.projectid);
+        break;
+      case 'bulk_create': {
+        const parentId = data.parentid === "None" ? null : data.parentid;
+        if (parentId && !this.items.has(parentId)) throw new Error(`No such parent: ${parentId}`);
+
+        let priority = data.starting_priority ?? 0;
+        for (const tree of JSON.parse(data.project_trees ?? "[]")) {
+          this.items.set(tree.id, { id: tree.id, nm: tree.nm ?? "", ct: tree.ct, lm: tree.ct, pr: priority++, prnt: parentId, metadata: {} });
+        }
+        break;
+      }
+      default:
+        throw new Error(`Unsupported operation: ${operation.type}`);
+    }
+  }
+
+  remove(id) {
+    for (const [childId, child] of this.items) {
+      if (child.prnt === id) this.remove(childId);
+    }
+    this.items.delete(id);
+  }
+}
+
+// A copy of a nested tree with fresh ids, so it can be served next to the original
+function withFreshIds(nodes) {
+  return (nodes ?? []).map(({ children, ...item }) => ({ ...item, id: crypto.randomUUID(), children: withFreshIds(children) }));
+}
+
+// The account: its main tree and the trees shared with it by share id. A shared tree shows up in the main tree as
+// a placeholder item whose "as" names the share. Revoked shares keep their listing and placeholder only.
+class FakeWorkFlowy {
+  constructor(fixture, shareCount = 0, revokedCount = 0) {
+    this.userId = 1000001;
+    this.joinedAt = Math.floor(Date.now() / 1000) - 86400 * 365;
+    this.main = new FakeTree(fixture, () => this.timestamp());
+    this.shares = new Map();
+    this.revoked = new Set();
+
+    let priority = Math.max(0, ...fixture.map(node => (node.pr ?? 0) + 1));
+    for (let i = 1; i <= shareCount; i++) {
+      const shareId = crypto.randomBytes(6).toString('base64url');
+      const name = `Shared ${i}`;
+      this.shares.set(shareId, new FakeTree([{ id: crypto.randomUUID(), nm: name, pr: 0, children: withFreshIds(fixture) }], () => this.timestamp()));
+      const placeholderId = crypto.randomUUID();
+      this.main.items.set(placeholderId, { id: placeholderId, nm: name, pr: priority++, as: shareId, prnt: null });
+      if (i > shareCount - revokedCount) this.revoked.add(shareId);
+    }
+  }
+
+  timestamp() {
+    return Math.floor(Date.now() / 1000) - this.joinedAt;
+  }
+
+  // The main tree, or the shared one `shareId` names
+  tree(shareId) {
+    if (!shareId) return this.main;
+    return this.revoked.has(shareId) ? undefined : this.shares.get(shareId);
+  }
+
+  initializationData() {
+    return {
+      projectTreeData: {
+        mainProjectTreeInfo: {
+          ownerId: this.userId,
+          dateJoinedTimestampInSeconds: this.joinedAt,
+          initialMostRecentOperationTransactionId: String(this.main.transactionId),
+        },
+        auxiliaryProjectTreeInfos: [...this.shares].map(([shareId, tree]) => ({
+          shareId,
+          initialMostRecentOperationTransactionId: String(tree.transactionId),
+        })),
+      },
+    };
+  }
+
+  // One result per payload entry, each run against the tree its share_id names
+  pushAndPoll(payload) {
+    return {
+      results: payload.map(entry => {
+        const tree = this.tree(entry.share_id);
+        if (!tree) {
+          return { error_encountered_in_remote_operations: true, error: `No such share: ${entry.share_id}` };
+        }
+        return tree.pushAndPoll(entry);
+      }),
+    };
+  }
+
+  // The API key endpoint only ever creates at the top of the root
+  createBullet(title) {
+    const id = crypto.randomUUID();
+    const operation = {
+      type: "bulk_create",
+      data: { parentid: "None", starting_priority: 0, project_trees: JSON.stringify([{ id, nm: title, ct: this.timestamp() }]) },
+    };
+    this.main.pushAndPoll({ most_recent_operation_transaction_id: String(this.main.transactionId), operations: [operation] });
+    return { id, name: title };
+  }
+}
+
+async function readBody(req) {
+  const chunks = [];
+  for await (const chunk of req) chunks.push(chunk);
+  return Buffer.concat(chunks);
+}
+
+// push_and_poll arrives as multipart form data, which fetch's Request knows how to take apart
+async function readForm(req, body) {
+  const request = new Request(`http://localhost${req.url}`, { method: req.method, headers: req.headers, body });
+  return request.formData();
+}
+
+async function handle(fake, req, res, options) {
+  const { pathname, searchParams } = new URL(req.url, 'http://localhost');
+  const endpoint = pathname.replace(/^\/+|\/+$/g, '');
+  const body = await readBody(req);
+
+  const delay = options.latency + Math.random() * options.jitter;
+  if (delay > 0) await new Promise(resolve => setTimeout(resolve, delay));
+
+  const send = (status, payload) => {
+    res.writeHead(status, { 'Content-Type': 'application/json' });
+    res.end(JSON.stringify(payload));
+  };
+
+  const failHere = !options.failPaths || options.failPaths.has(endpoint);
+  if (failHere && Math.random() < options.failRate) {
+    send(500, { error: "Injected failure" });
+    return;
+  }
+
+  switch (endpoint) {
+    case 'get_tree_data': {
+      const tree = fake.tree(searchParams.get('share_id'));
+      if (tree) send(200, tree.treeData());
+      else send(404, { error: `No such share: ${searchParams.get('share_id')}` });
+      return;
+    }
+    case 'get_initialization_data':
+      send(200, fake.initializationData());
+      return;
+    case 'push_and_poll': {
+      const form = await readForm(req, body);
+      send(200, fake.pushAndPoll(JSON.parse(form.get('push_poll_data') ?? "[]")));
+      return;
+    }
+    case 'api/bullets/create': {
+      const { new_bullet_title: title = "" } = JSON.parse(body.toString() || "{}");
+      send(200, fake.createBullet(title));
+      return;
+    }
+    default:
+      send(404, { error: `Unknown endpoint: ${endpoint}` });
+  }
+}
+
+function main() {
+  const options = parseOptions(process.argv.slice(2));
+  const fake = new FakeWorkFlowy(JSON.parse(fs.readFileSync(options.fixture, 'utf8')), options.shares, options.revoked);
+
+  const server = http.createServer((req, res) => {
+    handle(fake, req, res, options).catch(err => {
+      res.writeHead(500, { 'Content-Type': 'application/json' });
+      res.end(JSON.stringify({ error: err?.message ?? String(err) }));
+    });
+  });
+
+  server.listen(options.port, '127.0.0.1', () => {
+    console.log(`listening on http://127.0.0.1:${server.address().port}`);
+  });
+}
+
+main();
@@ -1,8 +1,8 @@
 #!/usr/bin/env node
 
 import { WorkFlowyClient } from './workflowy.js';
-import { loginWorkFlowy } from './workflowy-auth.js';
 import { fileURLToPath } from 'url';
+import readline from 'readline';
 import process from 'process';
 
 function usage() {
@@ -12,13 +12,17 @@ Usage:
 
 Commands:
   getTree
+  getTreeSync
+  pollChanges <transactionId> [userId [json {shareId: transactionId, ...}]]
   createNode <title>
-  createNodeCustom <title> <parentId>
+  createNodeCustom <title> <parentId> [id]
   editNode <newTitle> <projectId>
   deleteNode <projectId>
   completeNode <projectId>
   uncompleteNode <projectId>
+  pushBatch <json [{command, args}, ...]> [userId joinedAt transactionId [shareId]]
   auth
+  serve
 
 Examples:
   workflowy-cli.js getTree
@@ -28,73 +32,139 @@ Examples:
   process.exit(1);
 }
 
+class UsageError extends Error {}
+
+function requireArgs(args, count, message) {
+  if (args.length < count) throw new UsageError(message);
+}
+
+// Commands whose output is read by the plugin rather than people, printed without indentation
+const compactCommands = new Set(['getTreeSync', 'pollChanges', 'pushBatch']);
+
+async function runCommand(client, command, args) {
+  switch (command) {
+    case 'getTree':
+      return client.getTree();
+    case 'getTreeSync':
+      return client.getTreeSync();
+    case 'pollChanges': {
+      requireArgs(args, 1, "Missing <transactionId>.");
+      const [transactionId, userId, shared] = args;
+      return client.pollChanges(transactionId, userId || null, shared ? JSON.parse(shared) : {});
+    }
+    case 'createNode': {
+      requireArgs(args, 1, "Missing <title>.");
+      const [title] = args;
+      return client.createNode(title);
+    }
+    case 'createNodeCustom': {
+      requireArgs(args, 2, "Missing <title> or <parentId>.");
+      const [title, parentId, id] = args;
+      return client.createNodeCustom(title, parentId, id || undefined);
+    }
+    case 'editNode': {
+      requireArgs(args, 2, "Missing <newTitle> or <projectId>.");
+      const [newTitle, projectId] = args;
+      return client.editNode(newTitle, projectId);
+    }
+    case 'deleteNode': {
+      requireArgs(args, 1, "Missing <projectId>.");
+      const [projectId] = args;
+      return client.deleteNode(projectId);
+    }
+    case 'completeNode': {
+      requireArgs(args, 1, "Missing <projectId>.");
+      const [projectId] = args;
+      return client.completeNode(projectId);
+    }
+    case 'uncompleteNode': {
+      requireArgs(args, 1, "Missing <projectId>.");
+      const [projectId] = args;
+      return client.uncompleteNode(projectId);
+    }
+    case 'pushBatch': {
+      requireArgs(args, 1, "Missing <json>.");
+      const [mutations, userId, joinedAt, transactionId, shareId] = args;
+      const known = transactionId ? client.knownUserData(userId, joinedAt, transactionId) : null;
+      return client.pushBatch(JSON.parse(mutations), known, shareId || null);
+    }
+    default:
+      throw new UsageError(`Unknown command: ${command}`);
+  }
+}
+
+// Long-lived mode for the plugin: one JSON request per stdin line ({ id, command, args }),
+// one JSON reply per stdout line ({ id, ok, result | error }). Requests may complete out of order.
+function serve(client) {
+  const rl = readline.createInterface({ input: process.stdin, crlfDelay: Infinity });
+  const reply = (message) => process.stdout.write(JSON.stringify(message) + "\n");
+  let inFlight = 0;
+  let closed = false;
+
+  rl.on('line', async (line) => {
+    if (!line.trim()) return;
+
+    let request;
+    try {
+      request = JSON.parse(line);
+    } catch (err) {
+      reply({ id: null, ok: false, error: `Bad request: ${err.message}` });
+      return;
+    }
+
+    inFlight++;
+    try {
+      const result = await runCommand(client, request.command, request.args ?? []);
+      reply({ id: request.id, ok: true, result });
+    } catch (err) {
+      reply({ id: request.id, ok: false, error: err?.message ?? String(err) });
+    } finally {
+      inFlight--;
+      if (closed && inFlight === 0) process.exit(0);
+    }
+  });
+
+  rl.on('close', () => {
+    closed = true;
+    if (inFlight === 0) process.exit(0);
+  });
+}
+
 async function main() {
   const [,, command, ...args] = process.argv;
   if (!command) usage();
-  
+
+  if (command === 'auth') {
+    // Only auth needs the browser/Google login stack, keep it out of every other command's startup
+    const { loginWorkFlowy } = await import('./workflowy-auth.js');
+    try {
+      const sessionID = await loginWorkFlowy();
+      console.log('Authentication successful.');
+    } catch (err) {
+      console.error("Login failed:", err);
+      process.exit(1);
+    }
+    return;
+  }
+
   const client = new WorkFlowyClient();
 
+  if (command === 'serve') {
+    serve(client);
+    return;
+  }
+
   try {
-    switch (command) {
-      case 'getTree': {
-        const result = await client.getTree();
-        console.log(JSON.stringify(result, null, 2));
-        break;
-      }
-      case 'createNode': {
-        if (args.length < 1) { console.error("Missing <title>."); usage(); }
-        const [title] = args;
-        console.log(JSON.stringify(await client.createNode(title), null, 2));
-        break;
-      }
-      case 'createNodeCustom': {
-        if (args.length < 2) { console.error("Missing <title> or <parentId>."); usage(); }
-        const [title, parentId] = args;
-        console.log(JSON.stringify(await client.createNodeCustom(title, parentId), null, 2));
-        break;
-      }
-      case 'editNode': {
-        if (args.length < 2) { console.error("Missing <newTitle> or <projectId>."); usage(); }
-        const [newTitle, projectId] = args;
-        console.log(JSON.stringify(await client.editNode(newTitle, projectId), null, 2));
-        break;
-      }
-      case 'deleteNode': {
-        if (args.length < 1) { console.error("Missing <projectId>."); usage(); }
-        const [projectId] = args;
-        console.log(JSON.stringify(await client.deleteNode(projectId), null, 2));
-        break;
-      }
-      case 'completeNode': {
-        if (args.length < 1) { console.error("Missing <projectId>."); usage(); }
-        const [projectId] = args;
-        console.log(JSON.stringify(await client.completeNode(projectId), null, 2));
-        break;
-      }
-      case 'uncompleteNode': {
-        if (args.length < 1) { console.error("Missing <projectId>."); usage(); }
-        const [projectId] = args;
-        console.log(JSON.stringify(await client.uncompleteNode(projectId), null, 2));
-        break;
-      }
-      case 'auth': {
-        try {
-          const sessionID = await loginWorkFlowy();
-          console.log('Authentication successful.');
-        } catch (err) {
-          console.error("Login failed:", err);
-          process.exit(1);
-        }
-        break;
-      }
-      default:
-        console.error(`Unknown command: ${command}`);
-        usage();
-    }
+    const result = await runCommand(client, command, args);
+    console.log(JSON.stringify(result, null, compactCommands.has(command) ? 0 : 2));
   } catch (err) {
+    if (err instanceof UsageError) {
+      console.error(err.message);
+      usage();
+    }
     console.error("[ERROR]", err?.message ?? err);
     process.exit(1);
   }
 }
 
-main();
\ No newline at end of file
+main();
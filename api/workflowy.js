@@ -2,6 +2,7 @@ import { fileURLToPath } from 'url';
 import dotenv from "dotenv";
 import crypto from "crypto";
 import https from "https";
+import http from "http";
 import path from 'path';
 import fs from "fs";
 
@@ -10,9 +11,10 @@ dotenv.config({ quiet: true });
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = path.dirname(__filename);
 const configPath = path.join(__dirname, '.wfconfig.json');
-const config = JSON.parse(fs.readFileSync(configPath, 'utf8'));
+const config = fs.existsSync(configPath) ? JSON.parse(fs.readFileSync(configPath, 'utf8')) : {};
 
-const API_BASE = "https://workflowy.com";
+// Overridable so tests can point the client at a stand-in server (see fake-workflowy-server.js)
+const API_BASE = process.env.WORKFLOWY_API_BASE || "https://workflowy.com";
 
 export class WorkFlowyClient {
   constructor(sessionId = config.sessionid, apiKey = process.env.WORKFLOWY_API_KEY) {
@@ -29,12 +31,18 @@ export class WorkFlowyClient {
     return id;
   };
   
-  getTree = async () => {
-    const res = await fetch(`${API_BASE}/get_tree_data/`, {
+  // The main tree, or with `shareId` one of the trees shared with the account. Throws when the tree cannot be read,
+  // e.g. a share that was revoked.
+  getTree = async (shareId = null) => {
+    const query = shareId ? `?share_id=${encodeURIComponent(shareId)}` : "";
+    const res = await fetch(`${API_BASE}/get_tree_data/${query}`, {
       headers: { cookie: `sessionid=${this.sessionId}` },
     });
 
-    const data = await res.json();
+    const data = res.ok ? await res.json() : null;
+    if (!Array.isArray(data?.items)) {
+      throw new Error(`get_tree_data failed for ${shareId ? `share ${shareId}` : "the main tree"} (HTTP ${res.status})`);
+    }
     const itemMap = new Map();
 
     for (const item of data.items) {
@@ -54,6 +62,92 @@ export class WorkFlowyClient {
     return rootItems;
   }
 
+  // Full tree plus the transaction id it is current as of, so later polls only need the operations after it.
+  // The id is read before the tree so nothing committed in between can be missed; replaying an op is harmless.
+  // The session fields let callers skip get_initialization_data on later writes (see knownUserData).
+  // Every tree shared with the account comes along in `shares`, each with its own transaction id. All trees are
+  // fetched at once, so this takes as long as the slowest of them. A shared tree that cannot be read is left out
+  // and named in `failedShares` instead; only the main tree failing fails the whole fetch.
+  getTreeSync = async () => {
+    const userData = await this.getUserData();
+    const shareIds = Object.keys(userData.transactionIds).filter(treeID => treeID !== "Root");
+    const [main, ...shared] = await Promise.allSettled([this.getTree(), ...shareIds.map(shareId => this.getTree(shareId))]);
+    if (main.status === "rejected") {
+      throw main.reason;
+    }
+
+    const shares = [];
+    const failedShares = {};
+    shareIds.forEach((shareId, i) => {
+      if (shared[i].status === "fulfilled") {
+        shares.push({ shareId, transactionId: userData.transactionIds[shareId], tree: shared[i].value });
+      } else {
+        failedShares[shareId] = shared[i].reason?.message ?? String(shared[i].reason);
+      }
+    });
+
+    return {
+      transactionId: userData.recentID,
+      session: this.sessionOf(userData),
+      tree: main.value,
+      shares,
+      failedShares,
+    };
+  }
+
+  // Operations committed since `transactionId`, flattened out of the returned transactions. `shared` maps share ids
+  // to their own transaction ids; those trees are polled in the same push_and_poll and reported under `shares`.
+  // A shared tree the server would not poll is reported as {error} there, only the main tree failing throws.
+  pollChanges = async (transactionId, userID = null, shared = {}) => {
+    userID ||= (await this.getUserData()).userID;
+    const trees = [[null, transactionId], ...Object.entries(shared)];
+    const response = await this.pushPayload(trees.map(([shareId, recentID]) => this.payloadEntry([], recentID, shareId)), userID);
+
+    const polled = trees.map(([shareId, recentID], i) => {
+      const result = response?.results?.[i];
+      if (!result || result.error_encountered_in_remote_operations) {
+        return { error: `push_and_poll returned an error: ${JSON.stringify(result ?? response)}` };
+      }
+
+      return {
+        transactionId: result.new_most_recent_operation_transaction_id ?? recentID,
+        operations: this.concurrentOperations(result),
+      };
+    });
+
+    const [main, ...rest] = polled;
+    if (main.error) {
+      throw new Error(main.error);
+    }
+    return {
+      ...main,
+      shares: Object.fromEntries(rest.map((result, i) => [trees[i + 1][0], result])),
+    };
+  }
+
+  concurrentOperations = (result) => {
+    const operations = [];
+    for (const transaction of result.concurrent_remote_operation_transactions ?? []) {
+      const parsed = typeof transaction === "string" ? JSON.parse(transaction) : transaction;
+      operations.push(...(parsed.ops ?? []));
+    }
+    return operations;
+  }
+
+  // What a caller needs to keep to build userData itself
+  sessionOf = (userData) => ({
+    userId: userData.userID,
+    joinedAt: String(userData.joinedAt),
+  })
+
+  // userData equivalent to getUserData() from values the caller already tracks, without the round trip
+  knownUserData = (userID, joinedAt, recentID) => ({
+    userID,
+    joinedAt: Number(joinedAt),
+    timestamp: Math.floor(Date.now() / 1000) - Number(joinedAt),
+    recentID,
+  })
+
   getUserData = async (treeID = "Root") => {
     const res = await fetch(`${API_BASE}/get_initialization_data?client_version=21&client_version_v2=28&no_root_children=1`, {
       headers: { cookie: `sessionid=${this.sessionId}` },
@@ -64,24 +158,28 @@ export class WorkFlowyClient {
       Root: userData.mainProjectTreeInfo.initialMostRecentOperationTransactionId
     };
 
-    for (const tree of userData.auxiliaryProjectTreeInfos) {
+    for (const tree of userData.auxiliaryProjectTreeInfos ?? []) {
       lastTransactionIds[tree.shareId] = tree.initialMostRecentOperationTransactionId;
     }
 
     return {
       userID: userData.mainProjectTreeInfo.ownerId.toString(),
+      joinedAt: userData.mainProjectTreeInfo.dateJoinedTimestampInSeconds,
       timestamp: Math.floor(Date.now() / 1000) - userData.mainProjectTreeInfo.dateJoinedTimestampInSeconds,
       recentID: lastTransactionIds[treeID],
+      transactionIds: lastTransactionIds,
     };
   }
 
   createNode = async (title) => {
     const data = JSON.stringify({ new_bullet_title: title });
 
+    const url = new URL('/api/bullets/create/', API_BASE);
+    const transport = url.protocol === 'http:' ? http : https;
     const options = {
-      hostname: 'workflowy.com',
-      port: 443,
-      path: '/api/bullets/create/',
+      hostname: url.hostname,
+      port: url.port || (url.protocol === 'http:' ? 80 : 443),
+      path: url.pathname,
       method: 'POST',
       headers: {
         'Authorization': `Bearer ${this.apiKey}`,
@@ -91,7 +189,7 @@ export class WorkFlowyClient {
     };
 
     return new Promise((resolve, reject) => {
-      const req = https.request(options, (res) => {
+      const req = transport.request(options, (res) => {
         let response = '';
         res.on('data', chunk => response += chunk);
         res.on('end', () => {
@@ -109,13 +207,24 @@ export class WorkFlowyClient {
     });
   }
 
-  pushAndPoll = async (operation) => {
-    const userData = await this.getUserData();
-    const payload = [{
-      most_recent_operation_transaction_id: userData.recentID,
-      operations: [operation],
-    }];
+  pushAndPoll = async (operation, userData = null) => {
+    userData ??= await this.getUserData();
+    return this.pushOperations([operation], userData.recentID, userData.userID);
+  }
 
+  pushOperations = async (operations, recentID, userID, shareId = null) => {
+    return this.pushPayload([this.payloadEntry(operations, recentID, shareId)], userID);
+  }
+
+  // One tree's part of a push_and_poll; the main tree goes without a share_id
+  payloadEntry = (operations, recentID, shareId = null) => ({
+    most_recent_operation_transaction_id: recentID,
+    operations,
+    ...(shareId ? { share_id: shareId } : {}),
+  })
+
+  // push_and_poll answers with one result per payload entry, in order
+  pushPayload = async (payload, userID) => {
     const clientId = this.createClientId();
     const pushPollId = crypto.randomUUID().substring(0, 8);
     const formData = new FormData();
@@ -123,7 +232,7 @@ export class WorkFlowyClient {
     formData.append("client_version", "21");
     formData.append("push_poll_id", pushPollId);
     formData.append("push_poll_data", JSON.stringify(payload));
-    formData.append("crosscheck_user_id", userData.userID);
+    formData.append("crosscheck_user_id", userID);
 
     const res = await fetch(`${API_BASE}/push_and_poll`, {
       method: "POST",
@@ -136,103 +245,179 @@ export class WorkFlowyClient {
 
   editNode = async (newName, projectId) => {
     const userData = await this.getUserData();
-    const operation = {
-      type: "edit",
-      data: {
-        projectid: projectId,
-        metadataPatches: [],
-        metadataInversePatches: [],
-        name: newName
-      },
-      undo_data: {
-        previous_last_modified: 0,
-        previous_last_modified_by: null,
-        previous_name: "",
-        metadataPatches: []
-      },
-      client_timestamp: userData.timestamp
-    };
-
-    return this.pushAndPoll(operation);
+    return this.pushAndPoll(this.editOperation(userData, newName, projectId), userData);
   }
   
-  createNodeCustom = async (name, parentId = "None") => {
+  createNodeCustom = async (name, parentId = "None", id) => {
     const userData = await this.getUserData();
-    const operation = {
-      type: "bulk_create",
-      data: {
-        parentid: parentId,
-        starting_priority: 0,
-        isForSearch: false,
-        project_trees: JSON.stringify(
-          [
-            {
-              "nm": name,
-              "metadata": {},
-              "id": crypto.randomUUID().toString(),
-              "ct": userData.timestamp,
-              "cb": userData.userID
-            }
-          ]
-        ),
-      },
-      client_timestamp: userData.timestamp
-    }
-
-    return this.pushAndPoll(operation);
+    return this.pushAndPoll(this.createOperation(userData, name, parentId, id), userData);
   }
 
   deleteNode = async (projectId) => {
     const userData = await this.getUserData();
-    const operation = {
-      type: "delete",
-      data: {
-        projectid: projectId,
-      },
-      undo_data: {
-        previous_last_modified: 0,
-        previous_last_modified_by: null,
-        previous_name: "",
-      },
-      client_timestamp: userData.timestamp
-    };
-
-    return this.pushAndPoll(operation);
+    return this.pushAndPoll(this.projectOperation(userData, "delete", projectId), userData);
   }
   
   completeNode = async (projectId) => {
     const userData = await this.getUserData();
-    const operation = {
-      type: "complete",
-      data: {
-        projectid: projectId,
-      },
-      undo_data: {
-        previous_last_modified: 0,
-        previous_last_modified_by: null,
-        previous_name: "",
-      },
-      client_timestamp: userData.timestamp
-    };
-
-    return this.pushAndPoll(operation);
+    return this.pushAndPoll(this.projectOperation(userData, "complete", projectId), userData);
   }
   
   uncompleteNode = async (projectId) => {
     const userData = await this.getUserData();
-    const operation = {
-      type: "uncomplete",
-      data: {
-        projectid: projectId,
-      },
-      undo_data: {
-        previous_last_modified: 0,
-        previous_last_modified_by: null,
-        previous_name: "",
-      },
-      client_timestamp: userData.timestamp
+    return this.pushAndPoll(this.projectOperation(userData, "uncomplete", projectId), userData);
+  }
+
+  // Several mutations in a single push_and_poll. Each entry is { command, args } using the same commands and
+  // arguments as the single-operation methods above. The reply reports, per entry, whether the server ran it
+  // and the operation it ran, in the order they were given.
+  //
+  // With `known` (from knownUserData) the push goes out straight away against the caller's transaction id, and
+  // concurrentOperations holds everything committed since that id. If the server answers that it ran nothing,
+  // the push is retried once on fresh data and `rebased` tells the caller its id was not used. Transport errors
+  // are not retried: the lost response may belong to a push the server committed, and running it twice would
+  // duplicate its edits and creates.
+  //
+  // The server runs a push all or nothing, so a single stale operation would sink every other one in the batch.
+  // When the batch is refused, its operations are pushed again one at a time and each reports its own outcome.
+  //
+  // A batch goes to one tree: the main one, or with `shareId` a shared one, and `known` then holds that tree's id.
+  pushBatch = async (mutations, known = null, shareId = null) => {
+    const treeID = shareId ?? "Root";
+    let userData = known ?? await this.getUserData(treeID);
+    const operations = mutations.map(({ command, args = [] }) => this.buildOperation(userData, command, args));
+
+    let response = await this.pushOperations(operations, userData.recentID, userData.userID, shareId);
+    let rebased = !known;
+    if (known && this.pushRefused(response)) {
+      userData = await this.getUserData(treeID);
+      response = await this.pushOperations(operations, userData.recentID, userData.userID, shareId);
+      rebased = true;
+    }
+
+    const result = response?.results?.[0];
+    if (operations.length > 1 && result?.error_encountered_in_remote_operations) {
+      return this.pushEach(operations, userData, shareId);
+    }
+
+    const failed = !result || result.error_encountered_in_remote_operations;
+    const ran = this.ranOperations(result);
+
+    return {
+      transactionId: result?.new_most_recent_operation_transaction_id ?? null,
+      rebased,
+      session: this.sessionOf(userData),
+      concurrentOperations: result ? this.concurrentOperations(result) : [],
+      operations: operations.map((operation, i) => ({
+        ok: !failed && ran[i]?.type === operation.type,
+        operation: ran[i] ?? operation,
+      })),
     };
+  }
+
+  // Operations pushed one by one, each against the transaction the one before it left. Others' operations in between
+  // are not collected, so the reply is marked rebased and the caller catches up with a regular poll.
+  pushEach = async (operations, userData, shareId) => {
+    let recentID = userData.recentID;
+    const outcomes = [];
+    for (const operation of operations) {
+      const response = await this.pushOperations([operation], recentID, userData.userID, shareId);
+      const result = response?.results?.[0];
+      const ran = this.ranOperations(result);
+      recentID = result?.new_most_recent_operation_transaction_id ?? recentID;
+      outcomes.push({
+        ok: this.pushRan(response) && ran[0]?.type === operation.type,
+        operation: ran[0] ?? operation,
+      });
+    }
+
+    return {
+      transactionId: recentID,
+      rebased: true,
+      session: this.sessionOf(userData),
+      concurrentOperations: [],
+      operations: outcomes,
+    };
+  }
+
+  ranOperations = (result) => {
+    return result?.server_run_operation_transaction_json
+      ? JSON.parse(result.server_run_operation_transaction_json).ops ?? []
+      : [];
+  }
 
-    return this.pushAndPoll(operation);
+  // The server answered for the push and ran none of it
+  pushRefused = (response) => {
+    const result = response?.results?.[0];
+    return Boolean(result && (result.error_encountered_in_remote_operations || !result.server_run_operation_transaction_json));
   }
-}
\ No newline at end of file
+
+  pushRan = (response) => {
+    const result = response?.results?.[0];
+    return Boolean(result && !result.error_encountered_in_remote_operations && result.server_run_operation_transaction_json);
+  }
+
+  buildOperation = (userData, command, args) => {
+    switch (command) {
+      case 'editNode': return this.editOperation(userData, args[0], args[1]);
+      case 'createNodeCustom': return this.createOperation(userData, args[0], args[1] ?? "None", args[2] || undefined);
+      case 'deleteNode': return this.projectOperation(userData, "delete", args[0]);
+      case 'completeNode': return this.projectOperation(userData, "complete", args[0]);
+      case 'uncompleteNode': return this.projectOperation(userData, "uncomplete", args[0]);
+      default: throw new Error(`Cannot batch command: ${command}`);
+    }
+  }
+
+  editOperation = (userData, newName, projectId) => ({
+    type: "edit",
+    data: {
+      projectid: projectId,
+      metadataPatches: [],
+      metadataInversePatches: [],
+      name: newName
+    },
+    undo_data: {
+      previous_last_modified: 0,
+      previous_last_modified_by: null,
+      previous_name: "",
+      metadataPatches: []
+    },
+    client_timestamp: userData.timestamp
+  })
+
+  // The caller may pick the new node's id so it can recognise the create when it comes back
+  createOperation = (userData, name, parentId, id = crypto.randomUUID()) => ({
+    type: "bulk_create",
+    data: {
+      parentid: parentId,
+      starting_priority: 0,
+      isForSearch: false,
+      project_trees: JSON.stringify(
+        [
+          {
+            "nm": name,
+            "metadata": {},
+            "id": id.toString(),
+            "ct": userData.timestamp,
+            "cb": userData.userID
+          }
+        ]
+      ),
+    },
+    client_timestamp: userData.timestamp
+  })
+
+  // delete, complete and uncomplete only differ in their type
+  projectOperation = (userData, type, projectId) => ({
+    type,
+    data: {
+      projectid: projectId,
+    },
+    undo_data: {
+      previous_last_modified: 0,
+      previous_last_modified_by: null,
+      previous_name: "",
+    },
+    client_timestamp: userData.timestamp
+  })
+}
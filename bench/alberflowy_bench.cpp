@@ -0,0 +1,286 @@
+/*
+ * alberflowy_bench [--seed tree_data.json] [--queries N] [sizes...]
+ *
+ * Generates WorkFlowy trees of the given sizes (default 1k, 10k, 100k and 500k nodes) shaped like the seed tree:
+ * same distribution of child counts, names and markup drawn from it, same share of completed nodes. For each size
+ * it reports ingest time, the resident memory the cache adds (Linux) next to its own estimate, and latency
+ * percentiles for route listings, searches and optimistic mutations.
+ */
+
+#include "benchstats.h"
+#include "replysax.h"
+#include "treecache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <unistd.h>
+
+using namespace std;
+using ordered_json = nlohmann::ordered_json;
+
+#ifndef ALBERFLOWY_SOURCE_DIR
+#define ALBERFLOWY_SOURCE_DIR "."
+#endif
+
+namespace
+{
+    // What a generated tree borrows from the seed
+    struct Shape {
+        vector<string> names;
+        vector<int> childCounts;
+        double completed = 0.0;
+    };
+
+    void sampleShape(const json &nodes, Shape &shape, size_t &completed, size_t &total)
+    {
+        if (!nodes.is_array())
+            return;
+
+        for (const auto &node : nodes)
+        {
+            ++total;
+            if (node.contains("cp"))
+                ++completed;
+            if (node.contains("nm") && node["nm"].is_string() && !node["nm"].get<string>().empty())
+                shape.names.push_back(node["nm"].get<string>());
+
+            const bool hasChildren = node.contains("children") && node["children"].is_array();
+            shape.childCounts.push_back(hasChildren ? static_cast<int>(node["children"].size()) : 0);
+            if (hasChildren)
+                sampleShape(node["children"], shape, completed, total);
+        }
+    }
+
+    Shape loadShape(const string &path)
+    {
+        Shape shape;
+        ifstream in(path);
+        if (in)
+        {
+            try
+            {
+                size_t completed = 0, total = 0;
+                sampleShape(json::parse(in), shape, completed, total);
+                shape.completed = total ? double(completed) / total : 0.0;
+            }
+            catch (const exception &e)
+            {
+                cerr << "Ignoring seed " << path << ": " << e.what() << endl;
+            }
+        }
+
+        if (shape.names.empty())
+            shape.names = {"Inbox", "<b>Projects</b>", "Read <a href=\"https://example.com\">this</a>", "Groceries &amp; errands"};
+        if (all_of(shape.childCounts.begin(), shape.childCounts.end(), [](int n) { return n == 0; }))
+            shape.childCounts = {0, 0, 0, 2, 5};
+        return shape;
+    }
+
+    string makeId(mt19937_64 &rng)
+    {
+        char buffer[37];
+        const uint64_t a = rng(), b = rng();
+        snprintf(buffer, sizeof(buffer), "%08x-%04x-%04x-%04x-%012llx", uint32_t(a >> 32), unsigned(a >> 16) & 0xFFFF,
+                 unsigned(a) & 0xFFFF, unsigned(b >> 48), (unsigned long long)(b & 0xFFFFFFFFFFFFULL));
+        return buffer;
+    }
+
+    // Breadth-first growth with child counts drawn from the seed, so fan-out and depth follow its shape.
+    // Nodes carry the fields get_tree_data sends, including the ones the plugin drops.
+    // In the key order the CLI writes, a node's children after its fields
+    ordered_json generateTree(const Shape &shape, size_t size, mt19937_64 &rng)
+    {
+        uniform_int_distribution<size_t> pickName(0, shape.names.size() - 1);
+        uniform_int_distribution<size_t> pickCount(0, shape.childCounts.size() - 1);
+        bernoulli_distribution completed(shape.completed);
+
+        ordered_json tree = ordered_json::array();
+        size_t made = 0;
+        auto makeNode = [&](int position)
+        {
+            ordered_json node = {{"id", makeId(rng)},
+                                 {"nm", shape.names[pickName(rng)] + " " + to_string(made)},
+                                 {"ct", 60000000 + made},
+                                 {"lm", 70000000 + made},
+                                 {"pr", position * 100},
+                                 {"metadata", ordered_json::object()}};
+            if (completed(rng))
+                node["cp"] = 70000000 + made;
+            node["children"] = ordered_json::array();
+            ++made;
+            return node;
+        };
+
+        deque<ordered_json *> frontier;
+        while (made < size)
+        {
+            const int drawn = shape.childCounts[pickCount(rng)];
+            const int count = frontier.empty() ? max(1, drawn) : drawn;
+            ordered_json *parent = frontier.empty() ? &tree : &(*frontier.front())["children"];
+            if (!frontier.empty())
+                frontier.pop_front();
+
+            parent->get_ref<ordered_json::array_t &>().reserve(count);
+            for (int i = 0; i < count && made < size; ++i)
+                parent->push_back(makeNode(i));
+            for (auto &child : *parent)
+                frontier.push_back(&child);
+
+            if (frontier.empty() && made < size)
+                frontier.push_back(&tree.back());
+        }
+        return tree;
+    }
+
+    // Resident set size from /proc, after handing freed heap back so earlier garbage does not hide new pages;
+    // 0 where there is no /proc
+    size_t residentBytes()
+    {
+#ifdef __GLIBC__
+        malloc_trim(0);
+#endif
+        ifstream statm("/proc/self/statm");
+        size_t total = 0, resident = 0;
+        if (!(statm >> total >> resident))
+            return 0;
+        return resident * size_t(sysconf(_SC_PAGESIZE));
+    }
+
+    double millisecondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    void runSize(const Shape &shape, size_t size, size_t queries, uint64_t seed)
+    {
+        mt19937_64 rng(seed);
+        printf("%zu nodes\n", size);
+
+        // Ingest: the worker reply as the plugin receives it, its nodes read into the cache as it is parsed, then
+        // indexed
+        string reply;
+        {
+            ordered_json message = {{"id", 1}, {"ok", true}, {"result", {{"transactionId", "1"}, {"tree", generateTree(shape, size, rng)}}}};
+            reply = message.dump();
+        }
+
+        const size_t residentBefore = residentBytes();
+        auto start = chrono::steady_clock::now();
+        ReplySax sax;
+        json::sax_parse(reply, &sax);
+        TreeCache cache = std::move(sax.tree);
+        const double parsed = millisecondsSince(start);
+
+        start = chrono::steady_clock::now();
+        cache.rebuild();
+        const double indexed = millisecondsSince(start);
+        const size_t residentAfter = residentBytes();
+        printf("  ingest             %.1f MB reply, parse %.1f ms, index %.1f ms, %.1f MB resident (~%.1f MB estimated)\n",
+               reply.size() / 1e6, parsed, indexed, (residentAfter - min(residentBefore, residentAfter)) / 1048576.0,
+               cache.approximateBytes() / 1048576.0);
+        reply.clear();
+
+        vector<string> ids;
+        ids.reserve(cache.size());
+        for (const auto &[id, index] : cache.ids)
+            ids.push_back(cache.idOf(index));
+        sort(ids.begin(), ids.end());
+        uniform_int_distribution<size_t> pickId(0, ids.size() - 1);
+
+        // Route listings: resolve a folder by its path and produce the display text of every child
+        Stats listing;
+        volatile size_t sink = 0;
+        for (size_t i = 0; i < queries; ++i)
+        {
+            const QStringList route = i % 10 == 0 ? QStringList() : cache.pathOf(cache.lookup(ids[pickId(rng)]));
+            listing.time([&]
+                         {
+                const uint32_t parent = cache.resolveRoute(route);
+                if (parent != NoNode)
+                    for (uint32_t child = cache.nodes[parent].firstChild; child != NoNode; child = cache.nodes[child].nextSibling)
+                        sink = sink + cache.nodeDisplay(child).size(); });
+        }
+        listing.report("route listing");
+
+        // Searches for pieces of existing names
+        Stats searching;
+        for (size_t i = 0; i < queries; ++i)
+        {
+            const QString text = cache.nodeText(cache.lookup(ids[pickId(rng)]));
+            const qsizetype length = min<qsizetype>(text.size(), 3 + qsizetype(i % 4));
+            const QString term = text.mid(qsizetype(rng() % max<qsizetype>(1, text.size() - length + 1)), length);
+            searching.time([&]
+                           { cache.search(term, 50); });
+        }
+        searching.report("search");
+
+        // Optimistic mutations as the plugin applies them
+        Stats creating, editing, completing, removing;
+        for (size_t i = 0; i < queries; ++i)
+        {
+            JournalEntry journal;
+            const string parent = ids[pickId(rng)];
+            creating.time([&]
+                          { cache.applyLocal(NodeAction::Create, {{"nm", "New node " + to_string(i)}, {"parentID", parent}}, journal); });
+
+            const string id = ids[pickId(rng)];
+            if (!cache.contains(id))
+                continue;
+            editing.time([&]
+                         { cache.applyLocal(NodeAction::Edit, {{"id", id}, {"nm", "<b>Renamed</b> " + to_string(i)}}, journal); });
+            completing.time([&]
+                            { cache.applyLocal(NodeAction::Complete, {{"id", id}}, journal); });
+        }
+        for (size_t i = 0; i < queries / 10; ++i)
+        {
+            JournalEntry journal;
+            const string id = ids[pickId(rng)];
+            if (!cache.contains(id))
+                continue;
+            removing.time([&]
+                          { cache.applyLocal(NodeAction::Remove, {{"id", id}}, journal); });
+        }
+        creating.report("create");
+        editing.report("edit");
+        completing.report("complete");
+        removing.report("remove");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    string seedPath = ALBERFLOWY_SOURCE_DIR "/src/tree_data.json";
+    size_t queries = 2000;
+    vector<size_t> sizes;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+            seedPath = argv[++i];
+        else if (arg == "--queries" && i + 1 < argc)
+            queries = stoul(argv[++i]);
+        else
+            sizes.push_back(stoul(arg));
+    }
+    if (sizes.empty())
+        sizes = {1000, 10000, 100000, 500000};
+
+    const Shape shape = loadShape(seedPath);
+    printf("seed: %zu names, %.0f%% completed\n", shape.names.size(), shape.completed * 100);
+
+    for (size_t size : sizes)
+        runSize(shape, size, queries, 42 + size);
+    return 0;
+}
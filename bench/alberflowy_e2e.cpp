@@ -0,0 +1,298 @@
+/*
+ * alberflowy_e2e [--cycles N] [--latency ms] [--jitter ms] [--fail-rate p] [--fixture path] [--shares N] [--node path]
+ *
+ * End-to-end latency against api/fake-workflowy-server.js: starts the stand-in server and `workflowy serve` pointed
+ * at it, loads the tree through the worker the way the plugin does, then runs create/edit/complete/remove cycles.
+ * Each mutation is applied to the cache optimistically, then queued, pushed and settled through the same Outbox the
+ * plugin uses, against the session and transaction ids the plugin would keep. Reports percentiles
+ * for listing a folder, the optimistic change, confirmation by the server, and delta polls. With --shares the server
+ * also shares N copies of the fixture with the account; they are fetched and polled with the main tree, and cycles
+ * under their nodes push to their own tree.
+ */
+
+#include "benchstats.h"
+#include "cliworker.h"
+#include "outbox.h"
+#include "treecache.h"
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QMetaObject>
+#include <QProcess>
+#include <QProcessEnvironment>
+
+using namespace std;
+
+#ifndef ALBERFLOWY_SOURCE_DIR
+#define ALBERFLOWY_SOURCE_DIR "."
+#endif
+
+namespace
+{
+    struct Options {
+        int cycles = 200;
+        QString latency = QStringLiteral("0");
+        QString jitter = QStringLiteral("0");
+        QString failRate = QStringLiteral("0");
+        QString fixture = QStringLiteral(ALBERFLOWY_SOURCE_DIR "/src/tree_data.json");
+        QString shares = QStringLiteral("0");
+        QString node = QStringLiteral("node");
+    };
+
+    // What the plugin keeps next to the cache to push and poll against its own transaction ids, by share id
+    struct Session {
+        string userId;
+        string joinedAt;
+        map<string, string> transactionIds;
+    };
+
+    // Send one command and wait for its reply, handled back on this thread as the plugin does; `tree` gets the tree
+    // the reply carries, if any
+    bool call(CliWorker &worker, const QStringList &args, json &result, TreeCache &tree, int timeout = CliWorker::RequestTimeout)
+    {
+        QEventLoop loop;
+        bool ok = false;
+        worker.sendForTree(args, [&](bool success, json &&reply, TreeCache &&replyTree)
+                           {
+            ok = success;
+            result = std::move(reply);
+            tree = std::move(replyTree);
+            QMetaObject::invokeMethod(&loop, &QEventLoop::quit, Qt::QueuedConnection); }, timeout);
+        loop.exec();
+        return ok;
+    }
+
+    bool call(CliWorker &worker, const QStringList &args, json &result, int timeout = CliWorker::RequestTimeout)
+    {
+        TreeCache ignored;
+        return call(worker, args, result, ignored, timeout);
+    }
+
+    // Queue one mutation and push everything ready until it is settled, the way Plugin::flushMutations does
+    bool push(CliWorker &worker, Outbox &outbox, TreeCache &cache, Session &session, const QStringList &mutation, JournalEntry &&journal, string &createdId)
+    {
+        bool accepted = false;
+        bool settled = false;
+        const bool create = journal.action == NodeAction::Create;
+        outbox.queue(Outbox::Mutation{mutation, std::move(journal), [&](bool success, const json &operation)
+                                      {
+                                          accepted = success;
+                                          settled = true;
+                                          if (success && create)
+                                              createdId = TreeCache::createdId(operation);
+                                      }});
+
+        while (!settled)
+        {
+            uint64_t batch = 0;
+            const QStringList command = outbox.take(batch, session.userId, session.joinedAt, session.transactionIds);
+            if (command.isEmpty())
+                return false;
+
+            json output;
+            const bool success = call(worker, command, output);
+            const Outbox::Settlement settlement = outbox.settle(batch, success, output, cache, session.transactionIds);
+            if (settlement.answered)
+            {
+                const json known = output.value("session", json::object());
+                session.userId = known.value("userId", session.userId);
+                session.joinedAt = known.value("joinedAt", session.joinedAt);
+            }
+        }
+        return accepted;
+    }
+
+    Options parseOptions(const QStringList &arguments)
+    {
+        Options options;
+        for (qsizetype i = 1; i + 1 < arguments.size(); i += 2)
+        {
+            const QString &flag = arguments[i];
+            const QString &value = arguments[i + 1];
+            if (flag == QStringLiteral("--cycles"))
+                options.cycles = value.toInt();
+            else if (flag == QStringLiteral("--latency"))
+                options.latency = value;
+            else if (flag == QStringLiteral("--jitter"))
+                options.jitter = value;
+            else if (flag == QStringLiteral("--fail-rate"))
+                options.failRate = value;
+            else if (flag == QStringLiteral("--fixture"))
+                options.fixture = value;
+            else if (flag == QStringLiteral("--shares"))
+                options.shares = value;
+            else if (flag == QStringLiteral("--node"))
+                options.node = value;
+            else
+                cerr << "Ignoring unknown option " << flag.toStdString() << endl;
+        }
+        return options;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    const Options options = parseOptions(app.arguments());
+
+    // Stand-in server on a free port, which it announces on its first line
+    QProcess server;
+    server.start(options.node, {QStringLiteral(ALBERFLOWY_SOURCE_DIR "/api/fake-workflowy-server.js"), QStringLiteral("--fixture"), options.fixture,
+                                QStringLiteral("--latency"), options.latency, QStringLiteral("--jitter"), options.jitter,
+                                QStringLiteral("--fail-rate"), options.failRate, QStringLiteral("--shares"), options.shares});
+    QString apiBase;
+    while (apiBase.isEmpty() && server.waitForReadyRead(5000))
+    {
+        const QString line = QString::fromUtf8(server.readLine()).trimmed();
+        if (line.startsWith(QStringLiteral("listening on ")))
+            apiBase = line.mid(13);
+    }
+    if (apiBase.isEmpty())
+    {
+        cerr << "Stand-in server did not start: " << server.readAllStandardError().toStdString() << endl;
+        return 2;
+    }
+
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QStringLiteral("WORKFLOWY_API_BASE"), apiBase);
+    CliWorker worker(&app);
+    worker.start(options.node, {QStringLiteral(ALBERFLOWY_SOURCE_DIR "/api/workflowy-cli.js"), QStringLiteral("serve")}, environment);
+
+    TreeCache cache;
+    Outbox outbox;
+    Session session;
+    {
+        json result;
+        const auto start = chrono::steady_clock::now();
+        if (!call(worker, {QStringLiteral("getTreeSync")}, result, cache, CliWorker::NoTimeout) || !result.contains("tree"))
+        {
+            cerr << "getTreeSync failed: " << result.dump() << endl;
+            return 2;
+        }
+        const json shared = result.value("shares", json::array());
+        session = {result["session"].value("userId", ""), result["session"].value("joinedAt", ""), {{string(), result.value("transactionId", "")}}};
+        for (const auto &share : shared)
+            session.transactionIds[share.value("shareId", "")] = share.value("transactionId", "");
+
+        Stats ingest;
+        ingest.add(start);
+        printf("%s: %zu nodes in %zu trees, %d cycles\n", apiBase.toStdString().c_str(), cache.size(), cache.shares.size(), options.cycles);
+        ingest.report("full fetch");
+    }
+
+    vector<string> parents;
+    for (const auto &[id, index] : cache.ids)
+        parents.push_back(cache.idOf(index));
+    sort(parents.begin(), parents.end());
+    mt19937_64 rng(42);
+    uniform_int_distribution<size_t> pickParent(0, parents.size() - 1);
+
+    Stats listing, polling;
+    Stats local[4], confirmed[4];
+    const char *names[4] = {"create", "edit", "complete", "remove"};
+    size_t failures = 0;
+    volatile size_t sink = 0;
+
+    for (int cycle = 0; cycle < options.cycles; ++cycle)
+    {
+        const string parentId = parents[pickParent(rng)];
+        if (!cache.contains(parentId))
+            continue;
+
+        const QStringList route = cache.pathOf(cache.lookup(parentId));
+        listing.time([&]
+                     {
+            const uint32_t parent = cache.resolveRoute(route);
+            if (parent != NoNode)
+                for (uint32_t child = cache.nodes[parent].firstChild; child != NoNode; child = cache.nodes[child].nextSibling)
+                    sink = sink + cache.nodeDisplay(child).size(); });
+
+        // create, edit, complete, remove of one fresh node under a random parent
+        string id;
+        for (int step = 0; step < 4; ++step)
+        {
+            const NodeAction action = step == 0 ? NodeAction::Create : step == 1 ? NodeAction::Edit : step == 2 ? NodeAction::Complete : NodeAction::Remove;
+            json nodeInfo = step == 0 ? json::object({{"nm", "E2E " + to_string(cycle)}, {"parentID", parentId}}) : json::object({{"id", id}});
+            if (step == 1)
+                nodeInfo["nm"] = "<b>E2E</b> " + to_string(cycle);
+
+            QStringList mutation;
+            const QString qid = QString::fromStdString(id);
+            switch (action)
+            {
+            case NodeAction::Create: mutation = {QStringLiteral("createNodeCustom"), QString::fromStdString(nodeInfo["nm"].get<string>()), QString::fromStdString(parentId)}; break;
+            case NodeAction::Edit: mutation = {QStringLiteral("editNode"), QString::fromStdString(nodeInfo["nm"].get<string>()), qid}; break;
+            case NodeAction::Complete: mutation = {QStringLiteral("completeNode"), qid}; break;
+            case NodeAction::Remove: mutation = {QStringLiteral("deleteNode"), qid}; break;
+            }
+
+            const auto start = chrono::steady_clock::now();
+            JournalEntry journal;
+            if (!cache.applyLocal(action, nodeInfo, journal))
+            {
+                ++failures;
+                break;
+            }
+            local[step].add(start);
+            if (action == NodeAction::Create)
+                mutation << QString::fromStdString(journal.createdId);
+
+            string created;
+            if (!push(worker, outbox, cache, session, mutation, std::move(journal), created))
+            {
+                ++failures;
+                break;
+            }
+            confirmed[step].add(start);
+            if (action == NodeAction::Create)
+                id = created;
+        }
+
+        if (cycle % 10 == 9)
+        {
+            json shared = json::object();
+            for (const auto &[share, transactionId] : session.transactionIds)
+                if (!share.empty())
+                    shared[share] = transactionId;
+
+            json result;
+            const auto start = chrono::steady_clock::now();
+            const uint64_t poll = outbox.beginPoll();
+            bool applied = call(worker, {QStringLiteral("pollChanges"), QString::fromStdString(session.transactionIds[string()]), QString::fromStdString(session.userId), QString::fromStdString(shared.dump())}, result);
+            for (auto &[share, transactionId] : session.transactionIds)
+            {
+                const json tree = share.empty() ? result : result.value("shares", json::object()).value(share, json::object());
+                const json operations = tree.value("operations", json::array());
+                if (applied)
+                    outbox.settleFromPoll(poll, share, operations, cache);
+                applied = applied && cache.applyRemoteOperations(operations, cache.treeOf(share), &outbox.placeholders());
+                if (applied)
+                    transactionId = tree.value("transactionId", transactionId);
+            }
+
+            if (applied)
+                polling.add(start);
+            else
+                ++failures;
+        }
+    }
+
+    listing.report("listing");
+    for (int step = 0; step < 4; ++step)
+    {
+        local[step].report(string(names[step]) + " local");
+        confirmed[step].report(string(names[step]) + " confirmed");
+    }
+    polling.report("poll");
+    printf("  %zu failed steps\n", failures);
+
+    worker.stop();
+    server.kill();
+    server.waitForFinished(1000);
+    return 0;
+}
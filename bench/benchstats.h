@@ -0,0 +1,38 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Latency samples in microseconds, reported as percentiles
+struct Stats {
+    std::vector<double> samples;
+
+    template <typename F>
+    void time(F &&f)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        add(start);
+    }
+
+    void add(std::chrono::steady_clock::time_point start)
+    {
+        samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    double percentile(double p)
+    {
+        if (samples.empty())
+            return 0.0;
+        std::sort(samples.begin(), samples.end());
+        return samples[std::min(samples.size() - 1, size_t(p * samples.size()))];
+    }
+
+    void report(const std::string &label)
+    {
+        printf("  %-18s n=%-7zu p50=%9.2fus p90=%9.2fus p99=%9.2fus max=%9.2fus\n", label.c_str(), samples.size(),
+               percentile(0.50), percentile(0.90), percentile(0.99), percentile(1.0));
+    }
+};
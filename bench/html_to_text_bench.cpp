@@ -0,0 +1,126 @@
+/*
+ * html_to_text_bench [corpus.txt] [tree_data.json]
+ *
+ * Checks that htmlToText gives the same text as the Gumbo path for every name in the corpus and the sample tree,
+ * then times both. Exits non-zero on any mismatch.
+ */
+
+#include "htmltext.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+using namespace std;
+using json = nlohmann::json;
+
+#ifndef ALBERFLOWY_SOURCE_DIR
+#define ALBERFLOWY_SOURCE_DIR "."
+#endif
+
+static void collectNames(const json &nodes, vector<string> &names)
+{
+    if (!nodes.is_array())
+        return;
+
+    for (const auto &node : nodes)
+    {
+        if (node.contains("nm") && node["nm"].is_string())
+            names.push_back(node["nm"].get<string>());
+        if (node.contains("children"))
+            collectNames(node["children"], names);
+    }
+}
+
+// Nanoseconds per name for one pass of `convert` over `names`, best of `rounds`
+template <typename Convert>
+static double timePerName(const vector<string> &names, int rounds, Convert convert)
+{
+    double best = 1e18;
+    volatile size_t sink = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        const auto start = chrono::steady_clock::now();
+        for (const string &name : names)
+            sink = sink + convert(name).size();
+        const auto elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        best = min(best, elapsed / names.size());
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    const string corpusPath = argc > 1 ? argv[1] : ALBERFLOWY_SOURCE_DIR "/bench/html_corpus.txt";
+    const string treePath = argc > 2 ? argv[2] : ALBERFLOWY_SOURCE_DIR "/src/tree_data.json";
+
+    vector<string> names;
+    ifstream corpus(corpusPath);
+    if (!corpus)
+    {
+        cerr << "Cannot open corpus " << corpusPath << endl;
+        return 2;
+    }
+    for (string line; getline(corpus, line);)
+    {
+        if (!line.empty() && line[0] != '#')
+            names.push_back(line);
+    }
+
+    ifstream tree(treePath);
+    if (tree)
+    {
+        try
+        {
+            collectNames(json::parse(tree), names);
+        }
+        catch (const exception &e)
+        {
+            cerr << "Skipping " << treePath << ": " << e.what() << endl;
+        }
+    }
+
+    // Parity: the fast path must agree with Gumbo wherever it takes over
+    size_t fast = 0;
+    size_t mismatches = 0;
+    for (const string &name : names)
+    {
+        if (name.find('<') == string::npos)
+            continue;
+
+        string out;
+        if (!fastHtmlToText(name, out))
+            continue;
+
+        ++fast;
+        const string expected = gumboHtmlToText(name);
+        if (out != expected)
+        {
+            ++mismatches;
+            cerr << "MISMATCH\n  input: " << name << "\n  fast:  " << out << "\n  gumbo: " << expected << endl;
+        }
+    }
+
+    vector<string> markup;
+    copy_if(names.begin(), names.end(), back_inserter(markup), [](const string &name)
+            { return name.find('<') != string::npos; });
+
+    cout << names.size() << " names, " << markup.size() << " with markup, " << fast << " on the fast path, "
+         << mismatches << " mismatches" << endl;
+
+    if (!markup.empty())
+    {
+        constexpr int rounds = 200;
+        const double gumbo = timePerName(markup, rounds, gumboHtmlToText);
+        const double current = timePerName(markup, rounds, htmlToText);
+        cout << "gumbo:      " << gumbo << " ns/name" << endl;
+        cout << "htmlToText: " << current << " ns/name (" << gumbo / current << "x)" << endl;
+    }
+
+    return mismatches == 0 ? 0 : 1;
+}
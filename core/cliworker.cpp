@@ -0,0 +1,303 @@
+#include "cliworker.h"
+#include "metrics.h"
+#include "replysax.h"
+
+#include <cstring>
+
+#include <QDebug>
+#include <QTimer>
+#include <QtConcurrent>
+
+using namespace std;
+
+CliWorker::CliWorker(QObject *context) : context(context)
+{
+    replyParser.setMaxThreadCount(1);
+}
+
+// Nobody is left to hear about requests still in flight, so the process goes without failing them
+CliWorker::~CliWorker()
+{
+    if (process)
+    {
+        process->disconnect();
+        process->kill();
+        process->waitForFinished(1000);
+        delete process;
+    }
+}
+
+void CliWorker::start(const QString &executable, const QStringList &arguments, const QProcessEnvironment &environment)
+{
+    QProcess *started = new QProcess(context);
+    started->setProcessEnvironment(environment);
+    process = started;
+
+    const auto launched = chrono::steady_clock::now();
+    metrics.processesSpawned.fetch_add(1, memory_order_relaxed);
+    QObject::connect(started, &QProcess::started, context, [launched]()
+                     { metrics.spawn.recordSince(launched); });
+
+    QObject::connect(started, &QProcess::readyReadStandardOutput, context, [this, started]()
+                     { handleOutput(started); });
+    QObject::connect(started, &QProcess::readyReadStandardError, context, [started]()
+                     { qWarning() << "[workflowy-cli stderr]" << started->readAllStandardError(); });
+    QObject::connect(started, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), context, [this, started](int exitCode, QProcess::ExitStatus exitStatus)
+                     {
+        (void) exitStatus;
+        qWarning() << "WorkFlowy CLI worker exited with code" << exitCode;
+        handleOutput(started);
+        drop(started); });
+    QObject::connect(started, &QProcess::errorOccurred, context, [this, started](QProcess::ProcessError error)
+                     {
+        if (error == QProcess::FailedToStart) {
+            qWarning() << "WorkFlowy CLI worker failed to start:" << started->errorString();
+            drop(started);
+        } });
+
+    qDebug() << "Starting worker:" << executable << arguments.join(QStringLiteral(" "));
+    started->start(executable, arguments);
+}
+
+// Send a command to the running worker; the handler gets its reply, or a failure if the worker goes away first or
+// `timeout` ms pass without one. A timeout of NoTimeout waits as long as the worker lives.
+void CliWorker::send(const QStringList &args, ReplyHandler handler, int timeout)
+{
+    sendForTree(args, [handler = std::move(handler)](bool success, json &&result, TreeCache &&)
+                { handler(success, std::move(result)); },
+                timeout);
+}
+
+// Like send, with the tree of a reply that carries one (result.tree and the shares mounted on it) loaded into the
+// cache passed to the handler and left out of the json. The cache is empty for any other reply.
+void CliWorker::sendForTree(const QStringList &args, TreeReplyHandler handler, int timeout)
+{
+    if (!process)
+    {
+        handler(false, json::object({{"error", "CLI worker not running"}}), TreeCache());
+        return;
+    }
+
+    const quint64 id = nextRequestId++;
+    {
+        lock_guard<mutex> lock(pendingMutex);
+        pendingRequests[id] = PendingRequest{std::move(handler), chrono::steady_clock::now()};
+    }
+
+    json request = json::object({{"id", id}, {"command", args.first().toStdString()}, {"args", json::array()}});
+    for (const QString &arg : args.mid(1))
+    {
+        request["args"].push_back(arg.toStdString());
+    }
+
+    qDebug() << "Sending to worker:" << args.join(QStringLiteral(" "));
+    process->write(QByteArray::fromStdString(request.dump() + "\n"));
+    if (timeout > NoTimeout)
+    {
+        QTimer::singleShot(timeout, context, [this, id, timeout]()
+                           { expire(id, timeout); });
+    }
+}
+
+// A request the worker never answered in time; a reply arriving later finds nobody waiting and is dropped. The
+// command may still have run, so the failure says it timed out rather than that it did not happen.
+void CliWorker::expire(quint64 id, int timeout)
+{
+    TreeReplyHandler handler;
+    {
+        lock_guard<mutex> lock(pendingMutex);
+        auto it = pendingRequests.find(id);
+        if (it == pendingRequests.end())
+        {
+            return;
+        }
+        handler = std::move(it->second.handler);
+        pendingRequests.erase(it);
+    }
+
+    qWarning() << "[WorkFlowy CLI Error] No reply to request" << id << "within" << timeout << "ms";
+    handler(false, json::object({{"error", "CLI worker timed out"}, {"timedOut", true}}), TreeCache());
+}
+
+void CliWorker::stop()
+{
+    if (!process)
+    {
+        return;
+    }
+
+    QProcess *stopped = process;
+    drop(stopped);
+    stopped->kill();
+}
+
+// Split complete reply lines off the worker output; parsing them is left to the reply thread
+void CliWorker::handleOutput(QProcess *source)
+{
+    if (source != process)
+    {
+        return;
+    }
+
+    qsizetype from = buffer.size();
+    const QByteArray output = source->readAllStandardOutput();
+    metrics.bytesRead.fetch_add(output.size(), memory_order_relaxed);
+    buffer.append(output);
+    const auto received = chrono::steady_clock::now();
+
+    qsizetype newline;
+    while ((newline = buffer.indexOf('\n', from)) >= 0)
+    {
+        QByteArray line = buffer.left(newline);
+        buffer.remove(0, newline + 1);
+        from = 0;
+
+        if (!line.trimmed().isEmpty())
+        {
+            (void)QtConcurrent::run(&replyParser, [this, source, line, received]()
+                                    { handleReply(source, line, received); });
+        }
+    }
+}
+
+// Runs on the reply thread: parse one reply and pass it to the handler waiting on its id. A reply that cannot be
+// read or carries no id leaves its request without an answer, so everything pending is failed instead.
+void CliWorker::handleReply(QProcess *source, QByteArray line, chrono::steady_clock::time_point received)
+{
+    ReplySax sax;
+    try
+    {
+        ScopedTiming timing(metrics.parse);
+        bool parsed = json::sax_parse(line.constData(), line.constData() + line.size(), &sax);
+        // JSON.stringify writes lone surrogates as \uXXXX escapes, which are not valid JSON text
+        if (!parsed && replaceLoneSurrogates(line))
+        {
+            sax = ReplySax();
+            parsed = json::sax_parse(line.constData(), line.constData() + line.size(), &sax);
+        }
+        if (!parsed)
+        {
+            abandon(source, "Unreadable worker reply");
+            return;
+        }
+    }
+    catch (const exception &e)
+    {
+        qWarning() << "[WorkFlowy CLI Error] Unreadable worker reply:" << e.what();
+        abandon(source, "Unreadable worker reply");
+        return;
+    }
+    json reply = std::move(sax.root);
+
+    if (!reply.is_object() || !reply.contains("id") || !reply["id"].is_number_unsigned())
+    {
+        qWarning() << "[WorkFlowy CLI Error]" << QString::fromStdString(reply.is_object() ? reply.value("error", "Worker reply without id") : "Worker reply without id");
+        abandon(source, "Worker reply without id");
+        return;
+    }
+
+    TreeReplyHandler handler;
+    {
+        lock_guard<mutex> lock(pendingMutex);
+        auto it = pendingRequests.find(reply["id"].get<quint64>());
+        if (it == pendingRequests.end())
+        {
+            return;
+        }
+        handler = std::move(it->second.handler);
+        metrics.worker.record(received - it->second.sent);
+        pendingRequests.erase(it);
+    }
+
+    if (reply.value("ok", false))
+    {
+        if (sax.hasTree)
+        {
+            sax.tree.rebuild();
+        }
+        handler(true, std::move(reply["result"]), std::move(sax.tree));
+    }
+    else
+    {
+        qWarning() << "[WorkFlowy CLI Error]" << QString::fromStdString(reply.value("error", "unknown error"));
+        handler(false, std::move(reply), TreeCache());
+    }
+}
+
+// Give up on a worker whose replies can no longer be matched to requests: fail what it owes and stop it on the
+// context thread. The next command starts a fresh one.
+void CliWorker::abandon(QProcess *source, const char *reason)
+{
+    qWarning() << "[WorkFlowy CLI Error]" << reason << "- restarting the worker";
+    QMetaObject::invokeMethod(context, [this, source]()
+                              {
+        if (source != process)
+            return;
+        drop(source);
+        source->kill(); }, Qt::QueuedConnection);
+}
+
+// Rewrite \uXXXX escapes of unpaired UTF-16 surrogates to U+FFFD in place, both being six bytes. Returns whether any
+// were found.
+bool CliWorker::replaceLoneSurrogates(QByteArray &line)
+{
+    // A \uD800-\uDBFF (high) or \uDC00-\uDFFF (low) escape at i
+    auto surrogateAt = [&line](qsizetype i, bool high)
+    {
+        if (i + 6 > line.size() || line[i] != '\\' || line[i + 1] != 'u' || (line[i + 2] | 0x20) != 'd')
+            return false;
+        const char third = char(line[i + 3] | 0x20);
+        return high ? (third == '8' || third == '9' || third == 'a' || third == 'b') : (third >= 'c' && third <= 'f');
+    };
+
+    bool replaced = false;
+    bool inString = false;
+    for (qsizetype i = 0; i < line.size(); ++i)
+    {
+        if (line[i] == '"')
+        {
+            inString = !inString;
+        }
+        else if (inString && line[i] == '\\')
+        {
+            if (surrogateAt(i, true) && surrogateAt(i + 6, false))
+            {
+                i += 11;
+            }
+            else if (surrogateAt(i, true) || surrogateAt(i, false))
+            {
+                memcpy(line.data() + i + 2, "fffd", 4);
+                replaced = true;
+                i += 5;
+            }
+            else
+            {
+                ++i; // the escaped character, which may be a quote
+            }
+        }
+    }
+    return replaced;
+}
+
+// Forget a worker that is gone and fail whatever it still owed; the next command starts a fresh one
+void CliWorker::drop(QProcess *source)
+{
+    if (source != process)
+    {
+        return;
+    }
+
+    process = nullptr;
+    buffer.clear();
+    source->deleteLater();
+
+    unordered_map<quint64, PendingRequest> pending;
+    {
+        lock_guard<mutex> lock(pendingMutex);
+        pending.swap(pendingRequests);
+    }
+    for (auto &[id, request] : pending)
+    {
+        request.handler(false, json::object({{"error", "CLI worker exited"}}), TreeCache());
+    }
+}
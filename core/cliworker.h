@@ -0,0 +1,64 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+#include "treecache.h"
+
+#include <QByteArray>
+#include <QObject>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+using json = nlohmann::json;
+
+// Persistent `workflowy serve` process answering newline-delimited JSON requests by id.
+// Process signals are delivered through `context`; replies are parsed in arrival order on a thread of their own,
+// and handlers run there right after their reply is parsed. Trees in a reply are read straight into a TreeCache
+// rather than into the json, for handlers that take one. A request unanswered within its timeout fails with
+// "timedOut" set, and a reply that cannot be matched to its request fails everything pending and takes the worker
+// down with it.
+class CliWorker {
+    public:
+        using ReplyHandler = std::function<void(bool success, json &&result)>;
+        using TreeReplyHandler = std::function<void(bool success, json &&result, TreeCache &&tree)>;
+        static constexpr int RequestTimeout = 60000; // default per request, in ms
+        static constexpr int NoTimeout = 0;
+
+        explicit CliWorker(QObject *context);
+        ~CliWorker();
+
+        bool running() const { return process != nullptr; }
+        void start(const QString &executable, const QStringList &arguments, const QProcessEnvironment &environment);
+        void send(const QStringList &args, ReplyHandler handler, int timeout = RequestTimeout);
+        void sendForTree(const QStringList &args, TreeReplyHandler handler, int timeout = RequestTimeout);
+        void stop();
+
+    private:
+        QObject *context;
+        QProcess *process = nullptr;
+        QByteArray buffer;
+        quint64 nextRequestId = 1;
+        struct PendingRequest {
+            TreeReplyHandler handler;
+            std::chrono::steady_clock::time_point sent;
+        };
+        std::mutex pendingMutex;
+        std::unordered_map<quint64, PendingRequest> pendingRequests;
+
+        void handleOutput(QProcess *source);
+        void handleReply(QProcess *source, QByteArray line, std::chrono::steady_clock::time_point received);
+        void abandon(QProcess *source, const char *reason);
+        void expire(quint64 id, int timeout);
+        void drop(QProcess *source);
+        static bool replaceLoneSurrogates(QByteArray &line);
+
+        // Declared last so it is torn down first, while everything a running parse touches still exists
+        QThreadPool replyParser;
+};
@@ -0,0 +1,288 @@
+#include "htmltext.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <gumbo.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    // Position of the next '<' or '&' at or after `from`, or `size` if there is none
+    size_t findMarkup(const char *data, size_t from, size_t size)
+    {
+        size_t i = from;
+#ifdef __SSE2__
+        const __m128i lt = _mm_set1_epi8('<');
+        const __m128i amp = _mm_set1_epi8('&');
+        for (; i + 16 <= size; i += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, amp)));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+#endif
+        for (; i < size; ++i)
+        {
+            if (data[i] == '<' || data[i] == '&')
+                return i;
+        }
+        return size;
+    }
+
+    bool isAsciiAlpha(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool isAsciiAlnum(char c)
+    {
+        return isAsciiAlpha(c) || (c >= '0' && c <= '9');
+    }
+
+    bool isHtmlSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r';
+    }
+
+    bool isKnownTag(const string &name)
+    {
+        return name == "a" || name == "b" || name == "i" || name == "u" || name == "s" || name == "span" || name == "time";
+    }
+
+    void appendUtf8(string &out, uint32_t cp)
+    {
+        if (cp < 0x80)
+        {
+            out += static_cast<char>(cp);
+        }
+        else if (cp < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    // Code points a numeric reference decodes to unchanged; the rest are remapped or replaced by the HTML5 rules
+    bool isPlainCodePoint(uint32_t cp)
+    {
+        if (cp == '\t' || cp == '\n')
+            return true;
+        if (cp < 0x20 || (cp >= 0x7F && cp < 0xA0))
+            return false;
+        if (cp >= 0xD800 && cp <= 0xDFFF)
+            return false;
+        if ((cp >= 0xFDD0 && cp <= 0xFDEF) || (cp & 0xFFFE) == 0xFFFE)
+            return false;
+        return cp <= 0x10FFFF;
+    }
+
+    // Decode the reference starting at in[i] == '&'. Advances `i` past it; false when Gumbo should decide.
+    bool decodeEntity(const string &in, size_t &i, string &out)
+    {
+        const size_t size = in.size();
+        if (i + 1 >= size || (!isAsciiAlnum(in[i + 1]) && in[i + 1] != '#'))
+        {
+            // A lone ampersand is just text
+            out += '&';
+            ++i;
+            return true;
+        }
+
+        const size_t semicolon = in.find(';', i + 1);
+        if (semicolon == string::npos || semicolon - i > 10)
+            return false;
+
+        const string name = in.substr(i + 1, semicolon - i - 1);
+        if (name[0] == '#')
+        {
+            const bool hex = name.size() > 1 && (name[1] == 'x' || name[1] == 'X');
+            const size_t start = hex ? 2 : 1;
+            if (start >= name.size())
+                return false;
+
+            uint32_t cp = 0;
+            for (size_t k = start; k < name.size(); ++k)
+            {
+                const char c = name[k];
+                uint32_t digit;
+                if (c >= '0' && c <= '9')
+                    digit = c - '0';
+                else if (hex && c >= 'a' && c <= 'f')
+                    digit = c - 'a' + 10;
+                else if (hex && c >= 'A' && c <= 'F')
+                    digit = c - 'A' + 10;
+                else
+                    return false;
+                cp = cp * (hex ? 16 : 10) + digit;
+                if (cp > 0x10FFFF)
+                    return false;
+            }
+            if (!isPlainCodePoint(cp))
+                return false;
+            appendUtf8(out, cp);
+        }
+        else if (name == "amp")
+            out += '&';
+        else if (name == "lt")
+            out += '<';
+        else if (name == "gt")
+            out += '>';
+        else if (name == "quot")
+            out += '"';
+        else if (name == "apos")
+            out += '\'';
+        else if (name == "nbsp")
+            out += "\xC2\xA0";
+        else
+            return false;
+
+        i = semicolon + 1;
+        return true;
+    }
+
+    // Skip the tag starting at in[i] == '<' if it opens or closes one of the known inline elements
+    bool skipTag(const string &in, size_t &i)
+    {
+        const size_t size = in.size();
+        size_t k = i + 1;
+        const bool closing = k < size && in[k] == '/';
+        if (closing)
+            ++k;
+
+        const size_t nameStart = k;
+        while (k < size && isAsciiAlnum(in[k]))
+            ++k;
+        if (k == nameStart || !isAsciiAlpha(in[nameStart]))
+            return false;
+
+        string name = in.substr(nameStart, k - nameStart);
+        for (char &c : name)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        if (!isKnownTag(name))
+            return false;
+        if (k < size && !isHtmlSpace(in[k]) && in[k] != '>' && in[k] != '/')
+            return false;
+
+        // Attributes are dropped, but a quoted value may hold a '>'
+        char quote = 0;
+        char previous = 0;
+        for (; k < size; ++k)
+        {
+            const char c = in[k];
+            if (quote)
+            {
+                if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '"' || c == '\'')
+            {
+                // Quotes only delimit a value right after '='
+                if (closing || previous != '=')
+                    return false;
+                quote = c;
+            }
+            else if (c == '>')
+            {
+                i = k + 1;
+                return true;
+            }
+            else if (c == '<')
+            {
+                return false;
+            }
+
+            if (!isHtmlSpace(c))
+                previous = c;
+        }
+        return false;
+    }
+}
+
+bool fastHtmlToText(const string &in, string &out)
+{
+    // Leading whitespace, carriage returns and NULs follow special parser rules
+    if (in.empty() || isHtmlSpace(in[0]) || in.find('\r') != string::npos || memchr(in.data(), '\0', in.size()))
+    {
+        return false;
+    }
+
+    out.clear();
+    out.reserve(in.size());
+
+    const size_t size = in.size();
+    size_t i = 0;
+    while (i < size)
+    {
+        const size_t next = findMarkup(in.data(), i, size);
+        out.append(in, i, next - i);
+        i = next;
+        if (i == size)
+            break;
+
+        if (in[i] == '&' ? !decodeEntity(in, i, out) : !skipTag(in, i))
+            return false;
+    }
+    return true;
+}
+
+string gumboHtmlToText(const string &in)
+{
+    GumboOutput *g = gumbo_parse(in.c_str());
+    string out;
+
+    function<void(GumboNode *)> walk = [&](GumboNode *n)
+    {
+        switch (n->type)
+        {
+        case GUMBO_NODE_TEXT:
+        case GUMBO_NODE_WHITESPACE:
+            out.append(n->v.text.text);
+            break;
+        case GUMBO_NODE_ELEMENT:
+            for (size_t i = 0; i < n->v.element.children.length; ++i)
+                walk(static_cast<GumboNode *>(n->v.element.children.data[i]));
+            break;
+        default:
+            break;
+        }
+    };
+    walk(g->root);
+    gumbo_destroy_output(&kGumboDefaultOptions, g);
+    return out;
+}
+
+string htmlToText(const string &in)
+{
+    if (in.find('<') == string::npos)
+    {
+        return in;
+    }
+
+    string out;
+    if (fastHtmlToText(in, out))
+    {
+        return out;
+    }
+    return gumboHtmlToText(in);
+}
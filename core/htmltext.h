@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+
+// Plain text of a WorkFlowy name. Names only use a few inline tags (a, b, i, u, s, span, time) and entities,
+// which fastHtmlToText handles in one pass; anything else goes through a full Gumbo parse.
+std::string htmlToText(const std::string &in);
+
+// Single-pass conversion of the WorkFlowy subset. Returns false, leaving `out` unspecified, on markup
+// it does not recognize or cannot be sure to convert exactly as Gumbo would.
+bool fastHtmlToText(const std::string &in, std::string &out);
+
+// Text content of a full HTML5 parse
+std::string gumboHtmlToText(const std::string &in);
@@ -0,0 +1,84 @@
+#include "metrics.h"
+
+#include <bit>
+#include <cstdio>
+
+using namespace std;
+
+void LatencyHistogram::record(chrono::steady_clock::duration elapsed)
+{
+    const uint64_t micros = uint64_t(std::max<int64_t>(0, chrono::duration_cast<chrono::microseconds>(elapsed).count()));
+    const size_t bucket = min<size_t>(bit_width(micros), Buckets - 1);
+
+    counts[bucket].fetch_add(1, memory_order_relaxed);
+    total.fetch_add(1, memory_order_relaxed);
+    sumMicros.fetch_add(micros, memory_order_relaxed);
+
+    uint64_t seen = maxMicros.load(memory_order_relaxed);
+    while (micros > seen && !maxMicros.compare_exchange_weak(seen, micros, memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    const uint64_t n = count();
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    const uint64_t rank = std::max<uint64_t>(1, uint64_t(p * n + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < Buckets; ++i)
+    {
+        seen += counts[i].load(memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return i + 1 < Buckets ? min(uint64_t(1) << i, max()) : max();
+        }
+    }
+    return max();
+}
+
+uint64_t LatencyHistogram::mean() const
+{
+    const uint64_t n = count();
+    return n ? sumMicros.load(memory_order_relaxed) / n : 0;
+}
+
+vector<pair<const char *, const LatencyHistogram *>> Metrics::histograms() const
+{
+    return {{"spawn", &spawn}, {"worker", &worker}, {"parse", &parse}, {"command", &command}, {"refresh", &refresh},
+            {"index", &index}, {"html", &html}, {"query", &query}, {"mutation", &mutation}};
+}
+
+vector<pair<const char *, uint64_t>> Metrics::counters() const
+{
+    return {{"processes spawned", processesSpawned.load(memory_order_relaxed)},
+            {"bytes read", bytesRead.load(memory_order_relaxed)},
+            {"commands", commands.load(memory_order_relaxed)},
+            {"command failures", commandFailures.load(memory_order_relaxed)},
+            {"full fetches", fullFetches.load(memory_order_relaxed)},
+            {"polls", polls.load(memory_order_relaxed)}};
+}
+
+// One line per histogram, times in the unit that reads best
+string Metrics::describe(const LatencyHistogram &histogram)
+{
+    auto format = [](uint64_t micros)
+    {
+        char buffer[32];
+        if (micros >= 1000000)
+            snprintf(buffer, sizeof(buffer), "%.2fs", micros / 1e6);
+        else if (micros >= 1000)
+            snprintf(buffer, sizeof(buffer), "%.1fms", micros / 1e3);
+        else
+            snprintf(buffer, sizeof(buffer), "%lluus", (unsigned long long)micros);
+        return string(buffer);
+    };
+
+    return "n=" + to_string(histogram.count()) + " p50=" + format(histogram.percentile(0.50)) + " p90=" +
+           format(histogram.percentile(0.90)) + " p99=" + format(histogram.percentile(0.99)) + " max=" + format(histogram.max()) +
+           " mean=" + format(histogram.mean());
+}
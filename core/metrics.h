@@ -0,0 +1,67 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Latency histogram with fixed power-of-two buckets: bucket i holds samples below 2^i µs, the last one everything
+// from about a minute up. Recording is a few relaxed atomic adds, so any thread may record without a lock.
+class LatencyHistogram {
+    public:
+        static constexpr size_t Buckets = 27;
+
+        void record(std::chrono::steady_clock::duration elapsed);
+        void recordSince(std::chrono::steady_clock::time_point start) { record(std::chrono::steady_clock::now() - start); }
+
+        uint64_t count() const { return total.load(std::memory_order_relaxed); }
+        // Upper bound in µs of the bucket holding the p-th sample; exact enough to tell milliseconds from seconds
+        uint64_t percentile(double p) const;
+        uint64_t max() const { return maxMicros.load(std::memory_order_relaxed); }
+        uint64_t mean() const;
+
+    private:
+        std::array<std::atomic<uint64_t>, Buckets> counts{};
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> sumMicros{0};
+        std::atomic<uint64_t> maxMicros{0};
+};
+
+// Records into a histogram when it goes out of scope
+class ScopedTiming {
+    public:
+        explicit ScopedTiming(LatencyHistogram &histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTiming() { histogram.recordSince(start); }
+
+    private:
+        LatencyHistogram &histogram;
+        std::chrono::steady_clock::time_point start;
+};
+
+// Where time goes between a keystroke or action and its result, shown by `wf stats`
+struct Metrics {
+    LatencyHistogram spawn;    // CLI process start until it runs
+    LatencyHistogram worker;   // request written until its reply line arrives: node plus the network
+    LatencyHistogram parse;    // reply line to json
+    LatencyHistogram command;  // a CLI command until its reply is parsed and handed to its handler
+    LatencyHistogram refresh;  // refreshCachedTree until the sync it started is finished
+    LatencyHistogram index;    // full tree rebuild of the cache indexes
+    LatencyHistogram html;     // one name converted to text, sampled
+    LatencyHistogram query;    // handleTriggerQuery, including the items built for it
+    LatencyHistogram mutation; // updateCachedTree's optimistic change
+
+    std::atomic<uint64_t> processesSpawned{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> commands{0};
+    std::atomic<uint64_t> commandFailures{0};
+    std::atomic<uint64_t> fullFetches{0};
+    std::atomic<uint64_t> polls{0};
+
+    std::vector<std::pair<const char *, const LatencyHistogram *>> histograms() const;
+    std::vector<std::pair<const char *, uint64_t>> counters() const;
+    static std::string describe(const LatencyHistogram &histogram);
+};
+
+inline Metrics metrics;
@@ -0,0 +1,392 @@
+#include "outbox.h"
+
+#include <algorithm>
+
+#include <QDebug>
+
+using namespace std;
+
+void Outbox::queue(Mutation &&mutation)
+{
+    if (mutation.journal.action == NodeAction::Create)
+    {
+        pendingCreates.insert(mutation.journal.id);
+        if (!mutation.journal.createdId.empty())
+            creating[mutation.journal.createdId] = mutation.journal.id;
+    }
+    queued.push_back(std::move(mutation));
+}
+
+QStringList Outbox::take(uint64_t &batchId, const string &userId, const string &joinedAt, const map<string, string> &transactionIds)
+{
+    Batch batch;
+    vector<Mutation> held;
+    for (auto &mutation : queued)
+    {
+        if (resolveTempIds(mutation) && (batch.mutations.empty() || mutation.journal.share == batch.share))
+        {
+            batch.share = mutation.journal.share;
+            batch.mutations.push_back(std::move(mutation));
+        }
+        else
+        {
+            held.push_back(std::move(mutation));
+        }
+    }
+    queued.swap(held);
+
+    if (batch.mutations.empty())
+    {
+        return {};
+    }
+
+    json request = json::array();
+    for (const auto &mutation : batch.mutations)
+    {
+        json args = json::array();
+        for (const QString &arg : mutation.args.mid(1))
+        {
+            args.push_back(arg.toStdString());
+        }
+        request.push_back(json::object({{"command", mutation.args.first().toStdString()}, {"args", args}}));
+    }
+
+    const auto known = transactionIds.find(batch.share);
+    batch.tracked = known != transactionIds.end() && !userId.empty() && !joinedAt.empty();
+    QStringList command = {QStringLiteral("pushBatch"), QString::fromStdString(request.dump())};
+    if (batch.tracked)
+    {
+        command << QString::fromStdString(userId) << QString::fromStdString(joinedAt) << QString::fromStdString(known->second);
+    }
+    if (!batch.share.empty())
+    {
+        if (!batch.tracked)
+            command << QString() << QString() << QString();
+        command << QString::fromStdString(batch.share);
+    }
+
+    qDebug() << "Pushing" << batch.mutations.size() << "queued mutations.";
+    batchId = nextBatchId++;
+    inFlight.emplace(batchId, std::move(batch));
+    return command;
+}
+
+Outbox::Settlement Outbox::settle(uint64_t batchId, bool success, const json &output, TreeCache &cache, map<string, string> &transactionIds)
+{
+    Settlement settlement;
+    auto it = inFlight.find(batchId);
+    if (it == inFlight.end())
+    {
+        return settlement;
+    }
+    Batch batch = std::move(it->second);
+    inFlight.erase(it);
+    const vector<Mutation> &mutations = batch.mutations;
+
+    // No reply is not a rejection, the server may have run the batch after all
+    if (!success && output.is_object() && output.value("timedOut", false))
+    {
+        qWarning() << "Batch push timed out, the next poll settles its" << mutations.size() << "changes.";
+        batch.settleFrom = nextPoll;
+        unknown.push_back(std::move(batch));
+        settlement.unknown = true;
+        return settlement;
+    }
+
+    settlement.answered = success && output.is_object() && output.contains("operations") && output["operations"].is_array() && output["operations"].size() == mutations.size();
+    if (!settlement.answered)
+    {
+        qWarning() << "Batch push failed:" << QString::fromStdString(output.dump());
+    }
+    auto accepted = [&](size_t i)
+    { return settlement.answered && output["operations"][i].value("ok", false); };
+
+    // Settle the optimistic changes first so our creates keep their place under their real ids;
+    // rejected ones are undone newest first
+    for (size_t i = 0; i < mutations.size(); ++i)
+    {
+        if (accepted(i))
+        {
+            commit(mutations[i].journal, output["operations"][i].value("operation", json::object()), cache);
+        }
+    }
+    for (size_t i = mutations.size(); i-- > 0;)
+    {
+        if (!accepted(i))
+        {
+            rollback(mutations[i].journal, cache);
+            settlement.failed = true;
+        }
+    }
+
+    if (settlement.answered && batch.tracked && !output.value("rebased", true) && output.contains("transactionId") && output["transactionId"].is_string())
+    {
+        // Others' operations came first, then ours as the server ran them
+        json operations = output.value("concurrentOperations", json::array());
+        for (const auto &outcome : output["operations"])
+        {
+            if (outcome.value("ok", false))
+            {
+                operations.push_back(outcome.value("operation", json::object()));
+            }
+        }
+
+        try
+        {
+            settlement.synced = cache.applyRemoteOperations(operations, cache.treeOf(batch.share), &creating);
+        }
+        catch (const exception &e)
+        {
+            qWarning() << "Error applying WorkFlowy operations:" << e.what();
+        }
+
+        if (settlement.synced)
+        {
+            transactionIds[batch.share] = output["transactionId"].get<string>();
+        }
+    }
+
+    for (size_t i = 0; i < mutations.size(); ++i)
+    {
+        if (!mutations[i].callback)
+            continue;
+        if (settlement.answered)
+        {
+            const json &outcome = output["operations"][i];
+            mutations[i].callback(outcome.value("ok", false), outcome.value("operation", json::object()));
+        }
+        else
+        {
+            mutations[i].callback(false, output);
+        }
+    }
+    return settlement;
+}
+
+Outbox::Settlement Outbox::settleFromPoll(uint64_t poll, const string &share, const json &operations, TreeCache &cache)
+{
+    vector<bool> claimed(operations.size(), false);
+    return settleUnknown(
+        poll, [&](const Batch &batch)
+        { return batch.share == share; },
+        [&](const Mutation &mutation)
+        {
+            for (size_t k = 0; k < operations.size(); ++k)
+            {
+                if (!claimed[k] && pushed(mutation, operations[k]))
+                {
+                    claimed[k] = true;
+                    return operations[k];
+                }
+            }
+            return json();
+        },
+        cache, true);
+}
+
+// A freshly fetched tree shows a change that went through: a create by the id it asked for, an edit, complete or
+// delete by the state of its node. The fetched cache never held the optimistic changes, so nothing is undone in it.
+Outbox::Settlement Outbox::settleFromTree(uint64_t poll, TreeCache &cache)
+{
+    return settleUnknown(
+        poll, [&](const Batch &batch)
+        { return batch.share.empty() || cache.treeOf(batch.share) != TreeCache::NoTree; },
+        [&](const Mutation &mutation)
+        {
+            const JournalEntry &journal = mutation.journal;
+            const uint32_t index = cache.lookup(journal.id);
+            bool through = false;
+            switch (journal.action)
+            {
+            case NodeAction::Create: through = cache.contains(journal.createdId); break;
+            case NodeAction::Edit: through = index != NoNode && cache.nodeName(index) == mutation.args[1].toStdString(); break;
+            case NodeAction::Complete: through = index != NoNode && cache.completed(index) == (mutation.args.first() == QStringLiteral("completeNode")); break;
+            case NodeAction::Remove: through = index == NoNode; break;
+            }
+            return through ? json::object({{"data", {{"projectid", journal.action == NodeAction::Create ? journal.createdId : journal.id}}}}) : json();
+        },
+        cache, false);
+}
+
+// Settle the timed-out batches the first poll after them `covers`; `find` gives the operation a mutation became, null
+// when it did not go through. With `undo` the changes that did not are rolled back, as the cache still holds them.
+Outbox::Settlement Outbox::settleUnknown(uint64_t poll, const function<bool(const Batch &)> &covers, const function<json(const Mutation &)> &find, TreeCache &cache, bool undo)
+{
+    Settlement settlement;
+    for (auto it = unknown.begin(); it != unknown.end();)
+    {
+        if (it->settleFrom > poll || !covers(*it))
+        {
+            ++it;
+            continue;
+        }
+        const Batch batch = std::move(*it);
+        it = unknown.erase(it);
+        const vector<Mutation> &mutations = batch.mutations;
+        settlement.answered = true;
+
+        // Same order as a reply: what went through is committed first, the rest undone newest first
+        vector<json> found(mutations.size());
+        for (size_t i = 0; i < mutations.size(); ++i)
+        {
+            found[i] = find(mutations[i]);
+            if (!found[i].is_null())
+                commit(mutations[i].journal, found[i], cache);
+        }
+        for (size_t i = mutations.size(); i-- > 0;)
+        {
+            if (found[i].is_null())
+            {
+                if (undo)
+                    rollback(mutations[i].journal, cache);
+                else
+                    forget(mutations[i].journal);
+                settlement.failed = true;
+            }
+        }
+
+        qDebug() << "Settled timed-out batch," << count_if(found.begin(), found.end(), [](const json &operation)
+                                                               { return operation.is_null(); })
+                 << "of" << mutations.size() << "changes did not go through.";
+        for (size_t i = 0; i < mutations.size(); ++i)
+        {
+            if (!mutations[i].callback)
+                continue;
+            if (!found[i].is_null())
+                mutations[i].callback(true, found[i]);
+            else
+                mutations[i].callback(false, json::object({{"error", "Change not found after the push timed out"}}));
+        }
+    }
+    return settlement;
+}
+
+// Put every change the server has yet to confirm back onto a cache fetched without them, oldest first. Returns how
+// many found nothing to apply to, their node gone from the fetched tree.
+size_t Outbox::replay(TreeCache &cache)
+{
+    size_t stale = 0;
+    auto reapply = [&](Mutation &mutation)
+    {
+        resolveTempIds(mutation);
+        json value;
+        if (mutation.journal.action == NodeAction::Complete)
+            value = mutation.args.first() == QStringLiteral("completeNode");
+        else if (mutation.args.size() > 1)
+            value = mutation.args[1].toStdString();
+        if (!cache.reapply(mutation.journal, value))
+            ++stale;
+    };
+
+    // A batch still in flight was taken after any that already timed out
+    for (auto &batch : unknown)
+        for (auto &mutation : batch.mutations)
+            reapply(mutation);
+    for (auto &[id, batch] : inFlight)
+        for (auto &mutation : batch.mutations)
+            reapply(mutation);
+    for (auto &mutation : queued)
+        reapply(mutation);
+    return stale;
+}
+
+// Whether a polled operation is the one a mutation pushed: a create by the id it asked for, anything else by its type
+// and node, and an edit by the name it set as well
+bool Outbox::pushed(const Mutation &mutation, const json &operation)
+{
+    static const map<string, string> types = {
+        {"createNodeCustom", "bulk_create"}, {"editNode", "edit"}, {"deleteNode", "delete"}, {"completeNode", "complete"}, {"uncompleteNode", "uncomplete"}};
+    const auto type = types.find(mutation.args.first().toStdString());
+    if (type == types.end() || operation.value("type", "") != type->second)
+    {
+        return false;
+    }
+    if (mutation.journal.action == NodeAction::Create)
+    {
+        return !mutation.journal.createdId.empty() && TreeCache::createdId(operation) == mutation.journal.createdId;
+    }
+
+    const json data = operation.value("data", json::object());
+    if (data.value("projectid", "") != mutation.args.last().toStdString())
+    {
+        return false;
+    }
+    return type->second != "edit" || data.value("name", "") == mutation.args[1].toStdString();
+}
+
+// Swap temp ids the server has answered for their real ids. Returns false while one is still pending; a temp id
+// whose create was rejected is left in place and the mutation fails on the server like any other bad id.
+bool Outbox::resolveTempIds(Mutation &mutation)
+{
+    auto resolve = [this](string &id)
+    {
+        if (id.rfind("temp-", 0) != 0)
+            return true;
+        if (auto it = resolvedIds.find(id); it != resolvedIds.end())
+            id = it->second;
+        return !pendingCreates.count(id);
+    };
+
+    bool ready = true;
+    for (qsizetype i = 1; i < mutation.args.size(); ++i)
+    {
+        string arg = mutation.args[i].toStdString();
+        const bool known = resolve(arg);
+        mutation.args[i] = QString::fromStdString(arg);
+        ready = ready && known;
+    }
+
+    // A create is pending under its own temp id, only the parent matters for it
+    if (mutation.journal.action != NodeAction::Create)
+    {
+        ready = resolve(mutation.journal.id) && ready;
+    }
+    resolve(mutation.journal.parentId);
+    return ready;
+}
+
+// The server accepted an optimistic change. A create gets the id the server assigned, in place.
+void Outbox::commit(const JournalEntry &entry, const json &operation, TreeCache &cache)
+{
+    if (entry.action != NodeAction::Create)
+    {
+        return;
+    }
+
+    pendingCreates.erase(entry.id);
+    creating.erase(entry.createdId);
+    const string realId = TreeCache::createdId(operation);
+    if (realId.empty())
+    {
+        return;
+    }
+
+    qDebug() << "Node created with ID:" << QString::fromStdString(realId) << "replacing" << QString::fromStdString(entry.id);
+    resolvedIds[entry.id] = realId;
+    if (!cache.contains(realId))
+    {
+        cache.renameNode(entry.id, realId);
+    }
+    else
+    {
+        cache.eraseNode(entry.id);
+    }
+}
+
+// The server rejected an optimistic change; put back exactly what it replaced
+void Outbox::rollback(const JournalEntry &entry, TreeCache &cache)
+{
+    qDebug() << "Rolling back rejected change to" << QString::fromStdString(entry.id);
+    forget(entry);
+    cache.rollback(entry);
+}
+
+// A create that will not go through no longer holds up the mutations naming its temp id
+void Outbox::forget(const JournalEntry &entry)
+{
+    if (entry.action == NodeAction::Create)
+    {
+        pendingCreates.erase(entry.id);
+        creating.erase(entry.createdId);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <QStringList>
+
+#include "treecache.h"
+
+using json = nlohmann::json;
+
+// Optimistic changes on their way to WorkFlowy, shared by the plugin and the end-to-end bench so both push and settle
+// them the same way. A mutation is queued once it is in the cache, goes out with the others of its tree as one
+// `pushBatch` command, and is settled into the cache from the reply: accepted creates take their real ids, rejected
+// changes are undone newest first, and a push made against our own transaction id brings the cache up to the
+// transaction it left the tree at. A push whose reply timed out may still have gone through, so its changes stay in
+// the cache until the next poll shows which of them did. Not thread-safe; the caller guards the cache it passes in.
+class Outbox {
+    public:
+        struct Mutation {
+            QStringList args; // the CLI command and its arguments
+            JournalEntry journal;
+            std::function<void(bool success, const json &operation)> callback;
+        };
+
+        // What settling a batch did to the cache
+        struct Settlement {
+            bool answered = false; // the reply held an outcome for every operation
+            bool synced = false;   // the cache caught up to the transaction the push left the tree at
+            bool failed = false;   // some change was undone
+            bool unknown = false;  // the push timed out, a later poll settles it
+        };
+
+        void queue(Mutation &&mutation);
+        bool empty() const { return queued.empty(); }
+        // Nothing queued or on its way
+        bool drained() const { return queued.empty() && inFlight.empty(); }
+        // Nothing the server has yet to accept or refuse, timed-out pushes included
+        bool idle() const { return drained() && unknown.empty(); }
+        const TreeCache::Placeholders &placeholders() const { return creating; }
+
+        // Move the queued mutations of one tree that are ready into a batch and return the command that pushes it,
+        // empty when none is ready. Mutations naming a node whose create is unanswered wait for a later batch, and
+        // so do those of other trees.
+        QStringList take(uint64_t &batchId, const std::string &userId, const std::string &joinedAt, const std::map<std::string, std::string> &transactionIds);
+
+        // Settle the reply to a batch taken earlier and report each operation's outcome to its callback
+        Settlement settle(uint64_t batchId, bool success, const json &output, TreeCache &cache, std::map<std::string, std::string> &transactionIds);
+
+        // Number the poll about to be sent; a timed-out batch is settled by the first poll sent after it timed out
+        uint64_t beginPoll() { return nextPoll++; }
+
+        // Settle the timed-out batches of one tree from what that poll saw of it, before its operations are applied:
+        // changes found among the polled operations went through and are committed, the others are undone
+        Settlement settleFromPoll(uint64_t poll, const std::string &share, const json &operations, TreeCache &cache);
+
+        // The same from a full tree fetched after that poll number was taken, swapped in without any optimistic change
+        Settlement settleFromTree(uint64_t poll, TreeCache &cache);
+
+        // Put the changes still awaiting the server onto a freshly fetched cache, oldest first
+        size_t replay(TreeCache &cache);
+
+    private:
+        struct Batch {
+            std::vector<Mutation> mutations;
+            std::string share;
+            bool tracked = false; // pushed against our own transaction id
+            uint64_t settleFrom = 0; // once timed out, the first poll that can settle it
+        };
+
+        std::vector<Mutation> queued;
+        std::map<uint64_t, Batch> inFlight;
+        std::vector<Batch> unknown;
+        uint64_t nextBatchId = 1;
+        uint64_t nextPoll = 1;
+
+        // Temp ids of creates the server has not answered yet, and the real ids of those it has
+        std::unordered_set<std::string> pendingCreates;
+        std::unordered_map<std::string, std::string> resolvedIds;
+        // The ids those unanswered creates asked for, to the temp ids of their placeholders
+        TreeCache::Placeholders creating;
+
+        bool resolveTempIds(Mutation &mutation);
+        static bool pushed(const Mutation &mutation, const json &operation);
+        Settlement settleUnknown(uint64_t poll, const std::function<bool(const Batch &)> &covers, const std::function<json(const Mutation &)> &find, TreeCache &cache, bool undo);
+        void commit(const JournalEntry &entry, const json &operation, TreeCache &cache);
+        void rollback(const JournalEntry &entry, TreeCache &cache);
+        void forget(const JournalEntry &entry);
+};
@@ -0,0 +1,351 @@
+#include "replysax.h"
+
+#include <unordered_set>
+
+#include <QDebug>
+
+using namespace std;
+
+// A value whose key was dropped is consumed here, with everything nested in it
+bool ReplySax::skipping()
+{
+    if (skipDepth > 0)
+    {
+        return true;
+    }
+    if (skipNext)
+    {
+        skipNext = false;
+        return true;
+    }
+    return false;
+}
+
+json *ReplySax::put(json &&value)
+{
+    if (stack.empty())
+    {
+        root = std::move(value);
+        return &root;
+    }
+
+    // Inside a tree nothing goes into the json: a node's fields are read, anything else between nodes is dropped
+    const Frame frame = stack.back().second;
+    if (frame == Frame::Node)
+    {
+        readField(std::move(value));
+        return nullptr;
+    }
+    if (frame == Frame::Nodes)
+    {
+        return nullptr;
+    }
+
+    json &container = *stack.back().first;
+    if (container.is_array())
+    {
+        container.push_back(std::move(value));
+        return &container.back();
+    }
+
+    *slot = std::move(value);
+    return slot;
+}
+
+// Open an object or array. Arrays of tree nodes are result.tree, the tree of every entry of result.shares and the
+// "children" of a node.
+bool ReplySax::open(json &&value, bool isArray)
+{
+    Frame frame = Frame::Plain;
+    const Frame parent = stack.empty() ? Frame::Plain : stack.back().second;
+    if (!stack.empty())
+    {
+        if (isArray)
+        {
+            if (((parent == Frame::Result || parent == Frame::Share) && lastKey == "tree") || (parent == Frame::Node && lastKey == "children"))
+                frame = Frame::Nodes;
+            else if (parent == Frame::Result && lastKey == "shares")
+                frame = Frame::Shares;
+        }
+        else if (parent == Frame::Nodes)
+        {
+            frame = Frame::Node;
+        }
+        else if (parent == Frame::Shares)
+        {
+            frame = Frame::Share;
+        }
+        else if (stack.size() == 1 && stack.back().first->is_object() && lastKey == "result")
+        {
+            frame = Frame::Result;
+        }
+    }
+
+    if (frame == Frame::Nodes)
+    {
+        return openNodes(parent);
+    }
+    if (frame == Frame::Node)
+    {
+        pendingNodes.emplace_back();
+        stack.emplace_back(nullptr, Frame::Node);
+        return true;
+    }
+    if (parent == Frame::Nodes || parent == Frame::Node)
+    {
+        ++skipDepth;
+        return true;
+    }
+
+    if (frame == Frame::Share)
+        shareId.clear();
+    stack.emplace_back(put(std::move(value)), frame);
+    return true;
+}
+
+// An array of nodes: the children of the node being read, which is added now, or a whole tree. The json keeps an
+// empty array for a tree so replies still show they carry one.
+bool ReplySax::openNodes(Frame parent)
+{
+    if (parent == Frame::Node)
+    {
+        levels.push_back({addPendingNode(), levels.back().tree});
+    }
+    else
+    {
+        put(json::array());
+        if (parent == Frame::Share)
+        {
+            if (shareId.empty())
+                qWarning("Skipping a shared WorkFlowy tree sent before its share id.");
+            mount = shareId.empty() ? TreeCache::Mount() : tree.beginMount(shareId);
+            if (mount.tree == TreeCache::NoTree)
+            {
+                ++skipDepth;
+                return true;
+            }
+            levels.push_back({mount.parent, mount.tree});
+        }
+        else
+        {
+            levels.push_back({TreeCache::Root, 0});
+        }
+        hasTree = true;
+    }
+
+    stack.emplace_back(nullptr, Frame::Nodes);
+    return true;
+}
+
+// A field of the node being read; a completed node has its completion time in "cp"
+void ReplySax::readField(json &&value)
+{
+    PendingNode &node = pendingNodes.back();
+    node.late = node.index != NoNode;
+    if (lastKey == "cp")
+        node.completed = true;
+    else if (lastKey == "pr" && value.is_number())
+        node.priority = value.get<int>();
+    else if (!value.is_string())
+        return;
+    else if (lastKey == "id")
+        node.id = std::move(value.get_ref<json::string_t &>());
+    else if (lastKey == "nm")
+        node.name = std::move(value.get_ref<json::string_t &>());
+    else if (lastKey == "as")
+        node.mountAs = std::move(value.get_ref<json::string_t &>());
+}
+
+// Add the node being read under its parent, after its last added sibling, with the fields read so far
+uint32_t ReplySax::addPendingNode()
+{
+    PendingNode &node = pendingNodes.back();
+    Level &level = levels.back();
+    node.index = tree.addNode(level.parent, level.previous, node.id, node.name, node.priority, node.completed, level.tree);
+    level.previous = node.index;
+    if (!node.mountAs.empty())
+    {
+        tree.mountPoints[node.mountAs] = node.index;
+    }
+    return node.index;
+}
+
+// The node being read has ended. One added when its children started gets the fields that came after them, and
+// without an id it is left out with everything below it, as load() does.
+void ReplySax::finishPendingNode()
+{
+    PendingNode &node = pendingNodes.back();
+    if (node.index == NoNode)
+    {
+        if (node.id.empty())
+            return;
+        addPendingNode();
+    }
+    else if (node.id.empty())
+    {
+        // Placeholders met below it go with it
+        for (auto it = tree.mountPoints.begin(); it != tree.mountPoints.end();)
+        {
+            uint32_t above = it->second;
+            while (above != TreeCache::Root && above != node.index)
+                above = tree.nodes[above].parent;
+            it = above == node.index ? tree.mountPoints.erase(it) : std::next(it);
+        }
+        levels.back().previous = tree.nodes[node.index].prevSibling;
+        tree.unlink(node.index);
+        return;
+    }
+    else if (node.late)
+    {
+        Node &added = tree.nodes[node.index];
+        added.id = tree.toNodeId(node.id);
+        added.priority = node.priority;
+        tree.setNodeText(node.index, node.name);
+        if (node.completed && !tree.completed(node.index))
+        {
+            added.flags |= Node::Completed;
+            tree.appendDisplay(node.index);
+        }
+        if (!node.mountAs.empty())
+        {
+            tree.mountPoints.try_emplace(node.mountAs, node.index);
+        }
+    }
+}
+
+bool ReplySax::null()
+{
+    if (!skipping())
+        put(nullptr);
+    return true;
+}
+
+bool ReplySax::boolean(bool val)
+{
+    if (!skipping())
+        put(val);
+    return true;
+}
+
+bool ReplySax::number_integer(number_integer_t val)
+{
+    if (!skipping())
+        put(val);
+    return true;
+}
+
+bool ReplySax::number_unsigned(number_unsigned_t val)
+{
+    if (!skipping())
+        put(val);
+    return true;
+}
+
+bool ReplySax::number_float(number_float_t val, const string_t &)
+{
+    if (!skipping())
+        put(val);
+    return true;
+}
+
+bool ReplySax::string(string_t &val)
+{
+    if (skipping())
+        return true;
+    if (!stack.empty() && stack.back().second == Frame::Share && lastKey == "shareId")
+        shareId = val;
+    put(std::move(val));
+    return true;
+}
+
+bool ReplySax::binary(binary_t &val)
+{
+    if (!skipping())
+        put(json::binary(std::move(val)));
+    return true;
+}
+
+bool ReplySax::start_object(std::size_t)
+{
+    if (skipping())
+    {
+        ++skipDepth;
+        return true;
+    }
+    return open(json::object(), false);
+}
+
+bool ReplySax::key(string_t &val)
+{
+    if (skipDepth > 0)
+    {
+        return true;
+    }
+
+    // Tree nodes are read for only what the cache keeps
+    static const unordered_set<std::string> nodeFields = {"id", "nm", "pr", "cp", "as", "children"};
+    if (stack.back().second == Frame::Node)
+    {
+        if (nodeFields.count(val))
+            lastKey = std::move(val);
+        else
+            skipNext = true;
+        return true;
+    }
+
+    slot = &(*stack.back().first)[val];
+    lastKey = std::move(val);
+    return true;
+}
+
+bool ReplySax::end_object()
+{
+    if (skipDepth > 0)
+    {
+        --skipDepth;
+        return true;
+    }
+    if (stack.back().second == Frame::Node)
+    {
+        finishPendingNode();
+        pendingNodes.pop_back();
+    }
+    stack.pop_back();
+    return true;
+}
+
+bool ReplySax::start_array(std::size_t)
+{
+    if (skipping())
+    {
+        ++skipDepth;
+        return true;
+    }
+    return open(json::array(), true);
+}
+
+bool ReplySax::end_array()
+{
+    if (skipDepth > 0)
+    {
+        --skipDepth;
+        return true;
+    }
+    if (stack.back().second == Frame::Nodes)
+    {
+        levels.pop_back();
+        if (levels.empty() && mount.tree != TreeCache::NoTree)
+        {
+            tree.endMount(mount);
+            mount = TreeCache::Mount();
+        }
+    }
+    stack.pop_back();
+    return true;
+}
+
+bool ReplySax::parse_error(std::size_t position, const std::string &, const nlohmann::detail::exception &ex)
+{
+    qWarning() << "[WorkFlowy CLI Error] Unreadable worker reply at byte" << position << ":" << ex.what();
+    return false;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "treecache.h"
+
+using json = nlohmann::json;
+
+// SAX handler for worker replies. Builds the same json the DOM parser would, except for the tree nodes under
+// result.tree and result.shares[].tree: those go straight into `tree` with the shared trees mounted, and the json
+// keeps an empty array in their place. Only the node fields the cache reads are looked at. A share's "shareId" must
+// come before its tree, and the main tree before the shares for them to find their placeholders, which is how the
+// CLI writes them.
+class ReplySax : public nlohmann::json_sax<json> {
+    public:
+        json root;
+        TreeCache tree; // loaded but not rebuilt
+        bool hasTree = false;
+
+        bool null() override;
+        bool boolean(bool val) override;
+        bool number_integer(number_integer_t val) override;
+        bool number_unsigned(number_unsigned_t val) override;
+        bool number_float(number_float_t val, const string_t &s) override;
+        bool string(string_t &val) override;
+        bool binary(binary_t &val) override;
+        bool start_object(std::size_t elements) override;
+        bool key(string_t &val) override;
+        bool end_object() override;
+        bool start_array(std::size_t elements) override;
+        bool end_array() override;
+        bool parse_error(std::size_t position, const std::string &last_token, const nlohmann::detail::exception &ex) override;
+
+    private:
+        enum class Frame { Plain, Result, Shares, Share, Nodes, Node };
+        std::vector<std::pair<json *, Frame>> stack; // tree frames have no json
+        json *slot = nullptr;
+        std::string lastKey;
+        bool skipNext = false;
+        size_t skipDepth = 0;
+
+        // A node being read, added to the tree once its children start or it ends
+        struct PendingNode {
+            std::string id;
+            std::string name;
+            int priority = 0;
+            bool completed = false;
+            std::string mountAs;
+            uint32_t index = NoNode;
+            bool late = false; // a field came after the node was added
+        };
+        // One array of nodes: where they go and the last one added, so they keep their order
+        struct Level {
+            uint32_t parent;
+            uint16_t tree;
+            uint32_t previous = NoNode;
+        };
+        std::vector<PendingNode> pendingNodes;
+        std::vector<Level> levels;
+        std::string shareId;
+        TreeCache::Mount mount;
+
+        bool skipping();
+        json *put(json &&value);
+        bool open(json &&value, bool isArray);
+        bool openNodes(Frame parent);
+        void readField(json &&value);
+        uint32_t addPendingNode();
+        void finishPendingNode();
+};
@@ -0,0 +1,1418 @@
+#include "treecache.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <random>
+#include <unordered_set>
+
+#include <QDebug>
+
+using namespace std;
+
+// Case folding as QString does it, without the round trip for plain ASCII
+static string caseFolded(const string &text)
+{
+    if (all_of(text.begin(), text.end(), [](char c)
+               { return static_cast<unsigned char>(c) < 0x80; }))
+    {
+        string folded = text;
+        for (char &c : folded)
+        {
+            if (c >= 'A' && c <= 'Z')
+                c = char(c - 'A' + 'a');
+        }
+        return folded;
+    }
+    return QString::fromStdString(text).toCaseFolded().toStdString();
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Canonical lowercase UUIDs only, so uuid() gives back exactly the text that was parsed
+bool NodeId::parseUuid(const string &text, NodeId &id)
+{
+    if (text.size() != 36)
+    {
+        return false;
+    }
+
+    uint64_t halves[2] = {0, 0};
+    size_t digits = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (i == 8 || i == 13 || i == 18 || i == 23)
+        {
+            if (text[i] != '-')
+                return false;
+            continue;
+        }
+
+        const int value = hexValue(text[i]);
+        if (value < 0)
+            return false;
+        halves[digits / 16] = (halves[digits / 16] << 4) | uint64_t(value);
+        ++digits;
+    }
+
+    // Taken by the interned ids
+    if (halves[0] == Interned)
+    {
+        return false;
+    }
+    id = NodeId{halves[0], halves[1]};
+    return true;
+}
+
+// A version 4 UUID, for the ids of nodes we create
+NodeId NodeId::random()
+{
+    thread_local mt19937_64 generator{random_device{}()};
+    NodeId id{generator(), generator()};
+    id.hi = (id.hi & ~0xf000ull) | 0x4000ull;       // version 4
+    id.lo = (id.lo & ~(3ull << 62)) | (2ull << 62); // RFC 4122 variant
+    return id;
+}
+
+string NodeId::uuid() const
+{
+    static const char digits[] = "0123456789abcdef";
+    string text;
+    text.reserve(36);
+    for (int i = 0; i < 32; ++i)
+    {
+        if (i == 8 || i == 12 || i == 16 || i == 20)
+            text += '-';
+        const uint64_t half = i < 16 ? hi : lo;
+        text += digits[(half >> (60 - 4 * (i % 16))) & 15];
+    }
+    return text;
+}
+
+void TreeCache::clear()
+{
+    nodes.assign(1, Node{});
+    strings.clear();
+    ids.clear();
+    internedIds.clear();
+    internedSlots.clear();
+    trigramIndex.clear();
+    childNames.assign(16, NoNode);
+    childNamesUsed = 0;
+    childNamesLive = 0;
+    shares.assign(1, string());
+    mountParents.assign(1, string());
+    mountPoints.clear();
+    liveNodes = 0;
+    garbage = 0;
+}
+
+uint16_t TreeCache::treeOf(const string &shareId) const
+{
+    const auto it = find(shares.begin(), shares.end(), shareId);
+    return it == shares.end() ? NoTree : uint16_t(it - shares.begin());
+}
+
+// Binary id for an id string, interning it when it is not a UUID
+NodeId TreeCache::toNodeId(const string &id)
+{
+    NodeId binary;
+    if (NodeId::parseUuid(id, binary))
+    {
+        return binary;
+    }
+
+    auto [slot, added] = internedSlots.try_emplace(id, uint32_t(internedIds.size()));
+    if (added)
+    {
+        internedIds.push_back(id);
+    }
+    return NodeId{NodeId::Interned, slot->second};
+}
+
+// Index of the node with this id, NoNode when it is not in the tree
+uint32_t TreeCache::lookup(const string &id) const
+{
+    if (id.empty())
+    {
+        return NoNode;
+    }
+
+    NodeId binary;
+    if (!NodeId::parseUuid(id, binary))
+    {
+        auto slot = internedSlots.find(id);
+        if (slot == internedSlots.end())
+        {
+            return NoNode;
+        }
+        binary = NodeId{NodeId::Interned, slot->second};
+    }
+
+    auto it = ids.find(binary);
+    return it == ids.end() ? NoNode : it->second;
+}
+
+// Id string of a node, "" for the root
+string TreeCache::idOf(uint32_t index) const
+{
+    if (index == Root || index >= nodes.size())
+    {
+        return "";
+    }
+
+    const NodeId &id = nodes[index].id;
+    return id.hi == NodeId::Interned ? internedIds[id.lo] : id.uuid();
+}
+
+string TreeCache::nodeName(uint32_t index) const
+{
+    return strings.substr(nodes[index].name, nodes[index].nameLength);
+}
+
+string_view TreeCache::textView(uint32_t index) const
+{
+    return string_view(strings).substr(nodes[index].text, nodes[index].textLength);
+}
+
+string_view TreeCache::foldedView(uint32_t index) const
+{
+    return string_view(strings).substr(nodes[index].folded, nodes[index].foldedLength);
+}
+
+// Plain text name of a node
+QString TreeCache::nodeText(uint32_t index) const
+{
+    const string_view text = textView(index);
+    return QString::fromUtf8(text.data(), qsizetype(text.size()));
+}
+
+// Name as listed in Albert (struck through when completed)
+QString TreeCache::nodeDisplay(uint32_t index) const
+{
+    if (!completed(index))
+    {
+        return nodeText(index);
+    }
+    return QString::fromUtf8(strings.data() + displayOffset(nodes[index]), qsizetype(displayLength(nodes[index])));
+}
+
+uint32_t TreeCache::displayOffset(const Node &node)
+{
+    return max({node.name + node.nameLength, node.text + node.textLength, node.folded + node.foldedLength});
+}
+
+// A combining long stroke overlay (U+0336, two bytes) after every code point of the plain text
+size_t TreeCache::displayLength(const Node &node) const
+{
+    if (!(node.flags & Node::Completed))
+    {
+        return 0;
+    }
+    const string_view text = string_view(strings).substr(node.text, node.textLength);
+    return text.size() + 2 * size_t(count_if(text.begin(), text.end(), [](char c)
+                                             { return (static_cast<unsigned char>(c) & 0xC0) != 0x80; }));
+}
+
+// Strike through a node's plain text at the end of the arena, which must be where its strings end
+void TreeCache::appendDisplay(uint32_t index)
+{
+    const string_view text = textView(index);
+    string display;
+    display.reserve(displayLength(nodes[index]));
+    for (size_t i = 0; i < text.size();)
+    {
+        size_t next = i + 1;
+        while (next < text.size() && (static_cast<unsigned char>(text[next]) & 0xC0) == 0x80)
+            ++next;
+        display.append(text, i, next - i);
+        display += "\xCC\xB6";
+        i = next;
+    }
+    strings += display;
+}
+
+// The node and everything below it in the shape WorkFlowy sends, for the journal and the snapshot
+json TreeCache::subtree(uint32_t index) const
+{
+    const Node &node = nodes[index];
+    json result = json::object({{"id", idOf(index)}, {"nm", nodeName(index)}, {"pr", node.priority}, {"children", json::array()}});
+    if (node.flags & Node::Completed)
+    {
+        result["cp"] = true;
+    }
+    for (uint32_t child = node.firstChild; child != NoNode; child = nodes[child].nextSibling)
+    {
+        result["children"].push_back(subtree(child));
+    }
+    return result;
+}
+
+// The nodes, names and trees without the lookup indexes: enough to walk and read the tree, and a few memcpys to make
+TreeCache TreeCache::copyNodes() const
+{
+    TreeCache copy;
+    copy.nodes = nodes;
+    copy.strings = strings;
+    copy.internedIds = internedIds;
+    copy.shares = shares;
+    copy.mountParents = mountParents;
+    copy.liveNodes = liveNodes;
+    copy.garbage = garbage;
+    copy.loaded = loaded;
+    copy.version = version;
+    return copy;
+}
+
+// Arena bytes a node uses, counting shared ranges once
+size_t TreeCache::stringBytes(const Node &node) const
+{
+    return node.nameLength + (node.text != node.name ? node.textLength : 0) +
+           (node.folded != node.text && node.folded != node.name ? node.foldedLength : 0) + displayLength(node);
+}
+
+// Store a name with its plain and case-folded text at the end of the arena; queries only ever read these.
+// The three share one range when the name has no markup and no capitals, and text and name when it only has capitals.
+// Whatever the node had before stays behind as garbage until the next compaction.
+void TreeCache::setNodeText(uint32_t index, const string &name)
+{
+    Node &node = nodes[index];
+    garbage += stringBytes(node);
+    const bool linked = node.parent != NoNode;
+    if (linked)
+        removeChildName(index);
+
+    // Every 64th conversion is timed, enough for the histogram without a clock read per node
+    static atomic<uint32_t> conversions{0};
+    string text;
+    if ((conversions.fetch_add(1, memory_order_relaxed) & 63) == 0)
+    {
+        ScopedTiming timing(metrics.html);
+        text = htmlToText(name);
+    }
+    else
+    {
+        text = htmlToText(name);
+    }
+    const string folded = caseFolded(text);
+
+    node.name = uint32_t(strings.size());
+    node.nameLength = uint32_t(name.size());
+    strings += name;
+
+    node.text = node.name;
+    node.textLength = uint32_t(text.size());
+    if (text != name)
+    {
+        node.text = uint32_t(strings.size());
+        strings += text;
+    }
+
+    node.folded = node.text;
+    node.foldedLength = uint32_t(folded.size());
+    if (folded != text)
+    {
+        node.folded = folded == name ? node.name : uint32_t(strings.size());
+        if (folded != name)
+            strings += folded;
+    }
+
+    if (linked)
+        addChildName(index);
+    if (node.flags & Node::Completed)
+        appendDisplay(index);
+}
+
+// A node not linked anywhere yet
+uint32_t TreeCache::newNode(const string &id, const string &name, int priority, bool completed)
+{
+    const uint32_t index = uint32_t(nodes.size());
+    Node &node = nodes.emplace_back();
+    node.id = toNodeId(id);
+    node.priority = priority;
+    node.flags = completed ? Node::Completed : 0;
+    setNodeText(index, name);
+    ++liveNodes;
+    return index;
+}
+
+// Bulk loading: a new node under `parent` right after `previous` (first when NoNode), neither sorted nor indexed
+uint32_t TreeCache::addNode(uint32_t parent, uint32_t previous, const string &id, const string &name, int priority, bool completed, uint16_t tree)
+{
+    const uint32_t index = newNode(id, name, priority, completed);
+    Node &node = nodes[index];
+    node.tree = tree;
+    node.parent = parent;
+    node.prevSibling = previous;
+    node.nextSibling = previous == NoNode ? nodes[parent].firstChild : nodes[previous].nextSibling;
+    if (previous == NoNode)
+        nodes[parent].firstChild = index;
+    else
+        nodes[previous].nextSibling = index;
+    if (node.nextSibling != NoNode)
+        nodes[node.nextSibling].prevSibling = index;
+    return index;
+}
+
+// Add a json children array and everything below it under `parent`, keeping only the fields the plugin reads
+void TreeCache::addNodes(const json &children, uint32_t parent, uint16_t tree)
+{
+    if (!children.is_array())
+        return;
+
+    uint32_t previous = NoNode;
+    for (const auto &child : children)
+    {
+        if (!child.contains("id") || !child["id"].is_string())
+            continue;
+
+        const int priority = child.contains("pr") && child["pr"].is_number() ? child["pr"].get<int>() : 0;
+        previous = addNode(parent, previous, child["id"].get<string>(), child.value("nm", ""), priority, child.contains("cp"), tree);
+        if (child.contains("as") && child["as"].is_string())
+        {
+            mountPoints[child["as"].get<string>()] = previous;
+        }
+        if (child.contains("children"))
+        {
+            addNodes(child["children"], previous, tree);
+        }
+    }
+}
+
+// Replace the cache with the trees as fetched from WorkFlowy: the main one and the shared ones, each {shareId, tree}
+void TreeCache::load(const json &tree, const json &shared)
+{
+    clear();
+    addNodes(tree, Root);
+    for (const auto &share : shared)
+    {
+        if (share.contains("shareId") && share["shareId"].is_string() && share.contains("tree"))
+        {
+            mount(share["shareId"].get<string>(), share["tree"]);
+        }
+    }
+    rebuild();
+}
+
+// Bulk loading: add a shared tree in place of its placeholder in the main tree, or after the top-level nodes when
+// the main tree has none. Its top-level nodes take the place's priority so they list where the placeholder did.
+void TreeCache::mount(const string &shareId, const json &tree)
+{
+    const Mount place = beginMount(shareId);
+    if (place.tree == NoTree)
+    {
+        return;
+    }
+    addNodes(tree, place.parent, place.tree);
+    endMount(place);
+}
+
+// Register a shared tree and take the place of its placeholder; its nodes are then added under `parent`
+TreeCache::Mount TreeCache::beginMount(const string &shareId)
+{
+    Mount place;
+    if (shares.size() >= NoTree)
+    {
+        qWarning() << "Too many shared WorkFlowy trees, skipping" << QString::fromStdString(shareId);
+        return place;
+    }
+    place.tree = uint16_t(shares.size());
+    shares.push_back(shareId);
+    mountParents.resize(shares.size());
+
+    if (auto placeholder = mountPoints.find(shareId); placeholder != mountPoints.end())
+    {
+        // Dropped by the compaction of the rebuild, since nothing links it any more
+        place.parent = nodes[placeholder->second].parent;
+        place.priority = nodes[placeholder->second].priority;
+        unlink(placeholder->second);
+        mountPoints.erase(placeholder);
+        mountParents[place.tree] = place.parent == Root ? string() : idOf(place.parent);
+    }
+    else
+    {
+        for (uint32_t child = nodes[Root].firstChild; child != NoNode; child = nodes[child].nextSibling)
+        {
+            place.priority = max(place.priority, nodes[child].priority + 1);
+        }
+    }
+    place.existing = nodes[place.parent].firstChild;
+    return place;
+}
+
+// Bulk loading puts new nodes in front of the existing children; those of the shared tree take the place's priority
+void TreeCache::endMount(const Mount &place)
+{
+    for (uint32_t child = nodes[place.parent].firstChild; child != place.existing; child = nodes[child].nextSibling)
+    {
+        nodes[child].priority = place.priority;
+    }
+}
+
+// Sort, lay out and index the whole tree after loading
+void TreeCache::rebuild()
+{
+    ScopedTiming timing(metrics.index);
+    touch();
+    sortChildren(Root);
+    compact();
+    reindex();
+    findMountParents();
+    mountPoints.clear();
+    loaded = true;
+}
+
+// Read where each shared tree hangs off the layout: the parent of its top-level nodes. Covers trees restored from a
+// snapshot, which come without their placeholders; a shared tree with no nodes keeps what mount() recorded.
+void TreeCache::findMountParents()
+{
+    mountParents.resize(shares.size());
+    for (uint32_t index = Root + 1; index < nodes.size(); ++index)
+    {
+        const Node &node = nodes[index];
+        if (node.tree != 0 && node.tree < shares.size() && nodes[node.parent].tree != node.tree)
+        {
+            mountParents[node.tree] = node.parent == Root ? string() : idOf(node.parent);
+        }
+    }
+}
+
+// Listing order: priority (decided by WorkFlowy) with completed nodes sunk to the bottom, otherwise stable
+bool TreeCache::listedBefore(const Node &a, const Node &b)
+{
+    const bool a_cp = a.flags & Node::Completed;
+    const bool b_cp = b.flags & Node::Completed;
+
+    if (a_cp != b_cp)
+    {
+        return b_cp;
+    }
+    if (a_cp)
+    {
+        return false;
+    }
+    return a.priority < b.priority;
+}
+
+// Put every sibling list of a subtree in listing order; done once at ingest so listing never sorts
+void TreeCache::sortChildren(uint32_t parent)
+{
+    vector<uint32_t> children;
+    for (uint32_t child = nodes[parent].firstChild; child != NoNode; child = nodes[child].nextSibling)
+    {
+        children.push_back(child);
+    }
+
+    stable_sort(children.begin(), children.end(), [this](uint32_t a, uint32_t b)
+                { return listedBefore(nodes[a], nodes[b]); });
+
+    uint32_t previous = NoNode;
+    for (uint32_t child : children)
+    {
+        nodes[child].prevSibling = previous;
+        nodes[child].nextSibling = NoNode;
+        if (previous == NoNode)
+            nodes[parent].firstChild = child;
+        else
+            nodes[previous].nextSibling = child;
+        previous = child;
+        sortChildren(child);
+    }
+}
+
+// Lay the tree out again breadth first, every sibling group contiguous and in listing order, and drop what removed
+// nodes and replaced names left behind. Renumbers every node, so the indexes must be rebuilt after it.
+void TreeCache::compact()
+{
+    // A little headroom so the first changes after a rebuild do not reallocate everything
+    TreeCache packed;
+    packed.nodes.reserve(liveNodes + 1 + liveNodes / 32);
+    packed.strings.reserve(strings.size() - min(strings.size(), garbage) + strings.size() / 32);
+    auto copy = [&](uint32_t offset, uint32_t length)
+    {
+        const uint32_t copied = uint32_t(packed.strings.size());
+        packed.strings.append(strings, offset, length);
+        return copied;
+    };
+
+    vector<pair<uint32_t, uint32_t>> queue = {{Root, Root}};
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        const auto [from, to] = queue[head];
+        uint32_t previous = NoNode;
+        for (uint32_t child = nodes[from].firstChild; child != NoNode; child = nodes[child].nextSibling)
+        {
+            const Node &old = nodes[child];
+            const uint32_t index = uint32_t(packed.nodes.size());
+
+            Node node = old;
+            node.id = old.id.hi == NodeId::Interned ? packed.toNodeId(internedIds[old.id.lo]) : old.id;
+            node.parent = to;
+            node.firstChild = NoNode;
+            node.prevSibling = previous;
+            node.nextSibling = NoNode;
+            node.name = copy(old.name, old.nameLength);
+            node.text = old.text == old.name ? node.name : copy(old.text, old.textLength);
+            node.folded = old.folded == old.text ? node.text : old.folded == old.name ? node.name : copy(old.folded, old.foldedLength);
+            if (old.flags & Node::Completed)
+                copy(displayOffset(old), uint32_t(displayLength(old)));
+
+            if (previous == NoNode)
+                packed.nodes[to].firstChild = index;
+            else
+                packed.nodes[previous].nextSibling = index;
+            packed.nodes.push_back(node);
+            queue.emplace_back(child, index);
+            previous = index;
+        }
+    }
+
+    nodes = std::move(packed.nodes);
+    strings = std::move(packed.strings);
+    internedIds = std::move(packed.internedIds);
+    internedSlots = std::move(packed.internedSlots);
+    liveNodes = nodes.size() - 1;
+    garbage = 0;
+}
+
+// Build the id, route and search indexes over a freshly compacted tree
+void TreeCache::reindex()
+{
+    ids.clear();
+    trigramIndex.clear();
+    ids.reserve(liveNodes + liveNodes / 32);
+    childNames.clear();
+    resizeChildNames(liveNodes);
+
+    for (uint32_t index = Root + 1; index < nodes.size(); ++index)
+    {
+        ids[nodes[index].id] = index;
+        addChildName(index);
+        addSearchTerms(index);
+    }
+    for (auto &[trigram, postings] : trigramIndex)
+    {
+        postings.shrink_to_fit();
+    }
+}
+
+// Removed nodes and replaced names stay in the arrays until they make up half of them
+void TreeCache::compactIfSparse()
+{
+    const size_t used = nodes.size() * sizeof(Node) + strings.size();
+    if (garbage > 65536 && garbage * 2 > used)
+    {
+        compact();
+        reindex();
+    }
+}
+
+uint64_t TreeCache::childKey(uint32_t parent, string_view name)
+{
+    return uint64_t(hash<string_view>{}(name)) ^ (uint64_t(parent) * 0x9e3779b97f4a7c15ull);
+}
+
+// Start the route index over with room for `live` entries at a load of at most 0.4, keeping the entries it has;
+// tombstones are dropped on the way
+void TreeCache::resizeChildNames(size_t live)
+{
+    vector<uint32_t> entries;
+    entries.reserve(childNamesLive);
+    for (const uint32_t child : childNames)
+    {
+        if (child != NoNode && child != RemovedChild)
+            entries.push_back(child);
+    }
+
+    childNames.assign(max<size_t>(16, bit_ceil((live + 1) * 5 / 2)), NoNode);
+    childNamesUsed = 0;
+    childNamesLive = 0;
+    for (const uint32_t child : entries)
+    {
+        addChildName(child);
+    }
+}
+
+void TreeCache::addChildName(uint32_t index)
+{
+    if ((childNamesUsed + 1) * 2 > childNames.size())
+    {
+        resizeChildNames(childNamesLive + 1);
+    }
+
+    const size_t mask = childNames.size() - 1;
+    size_t slot = childKey(nodes[index].parent, textView(index)) & mask;
+    size_t reuse = NoNode;
+    for (; childNames[slot] != NoNode; slot = (slot + 1) & mask)
+    {
+        if (childNames[slot] == RemovedChild && reuse == NoNode)
+            reuse = slot;
+    }
+    if (reuse != NoNode)
+    {
+        slot = reuse;
+    }
+    else
+    {
+        ++childNamesUsed;
+    }
+    childNames[slot] = index;
+    ++childNamesLive;
+}
+
+void TreeCache::removeChildName(uint32_t index)
+{
+    const size_t mask = childNames.size() - 1;
+    for (size_t slot = childKey(nodes[index].parent, textView(index)) & mask; childNames[slot] != NoNode; slot = (slot + 1) & mask)
+    {
+        if (childNames[slot] == index)
+        {
+            childNames[slot] = RemovedChild;
+            --childNamesLive;
+            return;
+        }
+    }
+}
+
+// First child of `parent` listed under this plain-text name. Same-named siblings are rare, and only they fall back to
+// walking the sibling list for the one listed first.
+uint32_t TreeCache::childNamed(uint32_t parent, string_view name) const
+{
+    uint32_t found = NoNode;
+    size_t matches = 0;
+    const size_t mask = childNames.size() - 1;
+    for (size_t slot = childKey(parent, name) & mask; childNames[slot] != NoNode; slot = (slot + 1) & mask)
+    {
+        const uint32_t child = childNames[slot];
+        if (child != RemovedChild && nodes[child].parent == parent && !(nodes[child].flags & Node::Free) && textView(child) == name)
+        {
+            found = child;
+            ++matches;
+        }
+    }
+    if (matches < 2)
+    {
+        return found;
+    }
+
+    for (uint32_t child = nodes[parent].firstChild; child != NoNode; child = nodes[child].nextSibling)
+    {
+        if (nodes[child].textLength == name.size() && textView(child) == name)
+        {
+            return child;
+        }
+    }
+    return NoNode;
+}
+
+// Walk the route one segment at a time. The root for an empty route, NoNode when it leads nowhere.
+// Same-named siblings resolve to the one listed first.
+uint32_t TreeCache::resolveRoute(const QStringList &route) const
+{
+    uint32_t current = Root;
+    for (const QString &segment : route)
+    {
+        current = childNamed(current, segment.toStdString());
+        if (current == NoNode)
+        {
+            return NoNode;
+        }
+    }
+
+    return current;
+}
+
+// Node at `route`, or NoNode when the route is empty or leads nowhere
+uint32_t TreeCache::findNode(const QStringList &route) const
+{
+    if (route.isEmpty())
+    {
+        return NoNode;
+    }
+
+    return resolveRoute(route);
+}
+
+// Operations give a position among the siblings while the tree sorts by priority; pick one that lands there
+int TreeCache::priorityAt(uint32_t parent, int position) const
+{
+    if (parent == NoNode)
+    {
+        return 0;
+    }
+
+    vector<int> priorities;
+    for (uint32_t sibling = nodes[parent].firstChild; sibling != NoNode; sibling = nodes[sibling].nextSibling)
+    {
+        priorities.push_back(nodes[sibling].priority);
+    }
+    sort(priorities.begin(), priorities.end());
+
+    if (priorities.empty())
+    {
+        return 0;
+    }
+    if (position <= 0)
+    {
+        return priorities.front() - 1;
+    }
+    if (static_cast<size_t>(position) >= priorities.size())
+    {
+        return priorities.back() + 1;
+    }
+    return (priorities[position - 1] + priorities[position]) / 2;
+}
+
+// Post the node under every trigram of its name. New nodes have the highest index and are appended; a renamed
+// one is inserted in place, so every posting list stays sorted.
+void TreeCache::addSearchTerms(uint32_t index)
+{
+    const string_view folded = foldedView(index);
+    vector<uint32_t> trigrams;
+    for (size_t i = 0; i + 2 < folded.size(); ++i)
+    {
+        trigrams.push_back(trigramAt(folded, i));
+    }
+    sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+    for (uint32_t trigram : trigrams)
+    {
+        vector<uint32_t> &postings = trigramIndex[trigram];
+        if (postings.empty() || postings.back() < index)
+        {
+            postings.push_back(index);
+            continue;
+        }
+        auto at = lower_bound(postings.begin(), postings.end(), index);
+        if (*at != index)
+        {
+            postings.insert(at, index);
+        }
+    }
+}
+
+uint32_t TreeCache::trigramAt(string_view text, size_t i)
+{
+    return (uint32_t(uint8_t(text[i])) << 16) | (uint32_t(uint8_t(text[i + 1])) << 8) | uint32_t(uint8_t(text[i + 2]));
+}
+
+// Up to `limit` nodes whose name contains `term` (case-insensitive), shallow ones first.
+// Terms of three or more bytes intersect the trigram posting lists, shorter ones fall back to a scan.
+vector<uint32_t> TreeCache::search(const QString &term, size_t limit) const
+{
+    vector<uint32_t> matches;
+    const string folded = term.toCaseFolded().toStdString();
+    const string_view needle = folded;
+    if (needle.empty())
+    {
+        return matches;
+    }
+
+    auto accept = [&](uint32_t index)
+    {
+        if (!(nodes[index].flags & Node::Free) && foldedView(index).find(needle) != string_view::npos)
+            matches.push_back(index);
+    };
+
+    if (needle.size() < 3)
+    {
+        for (uint32_t index = Root + 1; index < nodes.size() && matches.size() < limit; ++index)
+        {
+            accept(index);
+        }
+        return matches;
+    }
+
+    vector<const vector<uint32_t> *> postings;
+    for (size_t i = 0; i + 2 < needle.size(); ++i)
+    {
+        auto it = trigramIndex.find(trigramAt(needle, i));
+        if (it == trigramIndex.end())
+        {
+            return matches;
+        }
+        postings.push_back(&it->second);
+    }
+
+    // Intersect starting from the rarest trigram
+    sort(postings.begin(), postings.end(), [](const auto *a, const auto *b)
+         { return a->size() < b->size(); });
+    postings.erase(unique(postings.begin(), postings.end()), postings.end());
+
+    vector<uint32_t> candidates = *postings.front();
+    for (size_t i = 1; i < postings.size() && !candidates.empty(); ++i)
+    {
+        vector<uint32_t> narrowed;
+        set_intersection(candidates.begin(), candidates.end(), postings[i]->begin(), postings[i]->end(), back_inserter(narrowed));
+        candidates.swap(narrowed);
+    }
+
+    for (uint32_t index : candidates)
+    {
+        if (matches.size() >= limit)
+            break;
+        accept(index);
+    }
+    return matches;
+}
+
+// Plain-text names from the root down to the node
+QStringList TreeCache::pathOf(uint32_t index) const
+{
+    QStringList path;
+    for (; index != Root && index != NoNode; index = nodes[index].parent)
+    {
+        path.prepend(nodeText(index));
+    }
+    return path;
+}
+
+// Link a node under `parent` at its place in listing order, after every sibling not listed after it
+void TreeCache::link(uint32_t index, uint32_t parent)
+{
+    uint32_t previous = NoNode;
+    uint32_t next = nodes[parent].firstChild;
+    while (next != NoNode && !listedBefore(nodes[index], nodes[next]))
+    {
+        previous = next;
+        next = nodes[next].nextSibling;
+    }
+
+    Node &node = nodes[index];
+    node.parent = parent;
+    node.prevSibling = previous;
+    node.nextSibling = next;
+    if (previous == NoNode)
+        nodes[parent].firstChild = index;
+    else
+        nodes[previous].nextSibling = index;
+    if (next != NoNode)
+        nodes[next].prevSibling = index;
+    addChildName(index);
+}
+
+// Take a node out of its sibling list; its subtree stays attached to it
+void TreeCache::unlink(uint32_t index)
+{
+    removeChildName(index);
+    Node &node = nodes[index];
+    if (node.prevSibling == NoNode)
+        nodes[node.parent].firstChild = node.nextSibling;
+    else
+        nodes[node.prevSibling].nextSibling = node.nextSibling;
+    if (node.nextSibling != NoNode)
+        nodes[node.nextSibling].prevSibling = node.prevSibling;
+    node.prevSibling = NoNode;
+    node.nextSibling = NoNode;
+}
+
+// Index a subtree that was just linked; the children came in by bulk loading, which link never saw
+void TreeCache::indexSubtree(uint32_t index)
+{
+    ids[nodes[index].id] = index;
+    addSearchTerms(index);
+    for (uint32_t child = nodes[index].firstChild; child != NoNode; child = nodes[child].nextSibling)
+    {
+        addChildName(child);
+        indexSubtree(child);
+    }
+}
+
+// Drop an unlinked subtree from the indexes and free its nodes; posting lists keep them until the next rebuild
+void TreeCache::releaseSubtree(uint32_t index)
+{
+    for (uint32_t child = nodes[index].firstChild; child != NoNode; child = nodes[child].nextSibling)
+    {
+        releaseSubtree(child);
+    }
+
+    removeChildName(index);
+    Node &node = nodes[index];
+    if (auto it = ids.find(node.id); it != ids.end() && it->second == index)
+    {
+        ids.erase(it);
+    }
+    node.flags |= Node::Free;
+    garbage += sizeof(Node) + stringBytes(node);
+    --liveNodes;
+}
+
+// Add a node (and any children it carries) under a parent at its place in listing order, and index it. The node and
+// its children join `tree`, or the tree of the parent when that is NoTree; a shared tree's top-level node sits under
+// a node of the main tree.
+uint32_t TreeCache::insertNode(const string &parentId, const json &node, uint16_t tree)
+{
+    const uint32_t parent = parentIndex(parentId);
+    const string id = node.value("id", "");
+    if (parent == NoNode || id.empty())
+    {
+        return NoNode;
+    }
+    touch();
+
+    const int priority = node.contains("pr") && node["pr"].is_number() ? node["pr"].get<int>() : 0;
+    const uint32_t index = newNode(id, node.value("nm", ""), priority, node.contains("cp"));
+    nodes[index].tree = tree == NoTree ? nodes[parent].tree : tree;
+    if (node.contains("children"))
+    {
+        addNodes(node["children"], index, nodes[index].tree);
+        sortChildren(index);
+    }
+    link(index, parent);
+    indexSubtree(index);
+    return index;
+}
+
+// Remove a node and its subtree, optionally handing the removed subtree back
+bool TreeCache::eraseNode(const string &id, json *removed)
+{
+    const uint32_t index = lookup(id);
+    if (index == NoNode)
+    {
+        return false;
+    }
+
+    touch();
+    if (removed)
+    {
+        *removed = subtree(index);
+    }
+    unlink(index);
+    releaseSubtree(index);
+    compactIfSparse();
+    return true;
+}
+
+// Remove everything of a shared tree that can no longer be read, e.g. after it was unshared. Its slot in `shares`
+// stays so the other trees keep their numbers. Returns how many top-level nodes of the share went.
+size_t TreeCache::unmount(const string &shareId)
+{
+    const uint16_t tree = treeOf(shareId);
+    if (tree == NoTree || tree == 0)
+    {
+        return 0;
+    }
+
+    // Erasing may compact and renumber the tree, so the share's top nodes are collected by id first
+    vector<string> tops;
+    for (uint32_t index = Root + 1; index < nodes.size(); ++index)
+    {
+        const Node &node = nodes[index];
+        if (!(node.flags & Node::Free) && node.tree == tree && nodes[node.parent].tree != tree)
+        {
+            tops.push_back(idOf(index));
+        }
+    }
+    for (const string &id : tops)
+    {
+        eraseNode(id);
+    }
+    return tops.size();
+}
+
+bool TreeCache::setNodeName(const string &id, const string &name)
+{
+    const uint32_t index = lookup(id);
+    if (index == NoNode)
+    {
+        return false;
+    }
+
+    touch();
+    setNodeText(index, name);
+    addSearchTerms(index);
+    compactIfSparse();
+    return true;
+}
+
+// Completion moves the node among its siblings; its name and route stay as they are
+bool TreeCache::setNodeCompleted(const string &id, bool completed)
+{
+    const uint32_t index = lookup(id);
+    if (index == NoNode)
+    {
+        return false;
+    }
+
+    touch();
+    if (completed && !this->completed(index))
+    {
+        // Stored again so the struck-through name can follow the others
+        setNodeText(index, nodeName(index));
+        nodes[index].flags |= Node::Completed;
+        appendDisplay(index);
+    }
+    else if (!completed && this->completed(index))
+    {
+        garbage += displayLength(nodes[index]);
+        nodes[index].flags &= ~Node::Completed;
+    }
+    const uint32_t parent = nodes[index].parent;
+    unlink(index);
+    link(index, parent);
+    return true;
+}
+
+// Give a node a new id in place, e.g. when the server assigns the real id of an optimistic create
+bool TreeCache::renameNode(const string &id, const string &newId)
+{
+    const uint32_t index = lookup(id);
+    if (index == NoNode || newId.empty() || contains(newId))
+    {
+        return false;
+    }
+
+    touch();
+    ids.erase(nodes[index].id);
+    nodes[index].id = toNodeId(newId);
+    ids[nodes[index].id] = index;
+    return true;
+}
+
+bool TreeCache::applyLocal(NodeAction action, const json &nodeInfo, JournalEntry &journal)
+{
+    journal = JournalEntry{action, nodeInfo.value("id", ""), "", json(), "", ""};
+    const uint32_t index = lookup(journal.id);
+    if (index != NoNode)
+    {
+        journal.parentId = idOf(nodes[index].parent);
+        journal.share = shareOf(index);
+    }
+
+    switch (action)
+    {
+    case NodeAction::Create:
+    {
+        // nodeInfo must include "nm" and optional "parentId"
+        string name = nodeInfo.value("nm", "");
+        string parentId = nodeInfo.value("parentID", "");
+        if (parentId == "None" || !contains(parentId))
+        {
+            parentId.clear();
+        }
+
+        // Create temporary placeholder
+        string tempId = "temp-" + to_string(
+                                      chrono::steady_clock::now().time_since_epoch().count());
+        json newNode;
+        newNode["nm"] = name;
+        newNode["id"] = tempId;
+        newNode["pr"] = 0;
+        journal.id = tempId;
+        journal.parentId = parentId;
+        journal.share = shareOf(parentIndex(parentId));
+        journal.createdId = NodeId::random().uuid();
+        return insertNode(parentId, newNode) != NoNode;
+    }
+    case NodeAction::Remove:
+    {
+        // nodeInfo includes full "id"
+        return eraseNode(journal.id, &journal.previous);
+    }
+    case NodeAction::Complete:
+    {
+        // nodeInfo includes full "id"
+        bool status = false;
+        if (index != NoNode)
+        {
+            journal.previous = completed(index);
+            status = setNodeCompleted(journal.id, !journal.previous.get<bool>());
+        }
+        return status;
+    }
+    case NodeAction::Edit:
+    {
+        // nodeInfo includes full "id" and new "nm"
+        bool status = false;
+        if (index != NoNode)
+        {
+            journal.previous = nodeName(index);
+            status = setNodeName(journal.id, nodeInfo.value("nm", ""));
+        }
+        return status;
+    }
+    default:
+        return false;
+    }
+}
+
+// Put back exactly what a rejected optimistic change replaced
+void TreeCache::rollback(const JournalEntry &journal)
+{
+    switch (journal.action)
+    {
+    case NodeAction::Create:
+        eraseNode(journal.id);
+        break;
+    case NodeAction::Edit:
+        setNodeName(journal.id, journal.previous.get<string>());
+        break;
+    case NodeAction::Complete:
+        setNodeCompleted(journal.id, journal.previous.get<bool>());
+        break;
+    case NodeAction::Remove:
+        if (!contains(journal.id) && parentIndex(journal.parentId) != NoNode)
+        {
+            insertNode(journal.parentId, journal.previous, treeOf(journal.share));
+        }
+        break;
+    }
+}
+
+// Make an optimistic change again on a cache fetched without it, refreshing what the journal holds to undo it there.
+// `value` is what the change set: the name of a create or edit, the state of a complete. A create the server already
+// ran, or a node already gone, needs nothing; false when the change no longer has anything to apply to.
+bool TreeCache::reapply(JournalEntry &journal, const json &value)
+{
+    const uint32_t index = lookup(journal.id);
+    switch (journal.action)
+    {
+    case NodeAction::Create:
+        if (index != NoNode || contains(journal.createdId))
+            return true;
+        return insertNode(journal.parentId, json::object({{"id", journal.id}, {"nm", value}, {"pr", 0}}), treeOf(journal.share)) != NoNode;
+    case NodeAction::Edit:
+        if (index == NoNode)
+            return false;
+        journal.previous = nodeName(index);
+        return setNodeName(journal.id, value.get<string>());
+    case NodeAction::Complete:
+        if (index == NoNode)
+            return false;
+        journal.previous = completed(index);
+        return setNodeCompleted(journal.id, value.get<bool>());
+    case NodeAction::Remove:
+        if (index == NoNode)
+            return true;
+        journal.parentId = idOf(nodes[index].parent);
+        return eraseNode(journal.id, &journal.previous);
+    }
+    return false;
+}
+
+// Id of the node a create operation made, as the server ran it; "" if there is none to read
+string TreeCache::createdId(const json &operation)
+{
+    const json data = operation.value("data", json::object());
+    string id = data.value("projectid", "");
+    if (id.empty() && data.contains("project_trees") && data["project_trees"].is_string())
+    {
+        try
+        {
+            const json trees = json::parse(data["project_trees"].get<string>());
+            id = trees.at(0).value("id", "");
+        }
+        catch (const exception &e)
+        {
+            qWarning() << "Error parsing creation result:" << e.what();
+        }
+    }
+    return id;
+}
+
+// Replay operations polled from push_and_poll for one tree onto the cache; "None" as a parent is the top level of
+// that tree, which for a shared tree is wherever it is mounted. Returns false when an operation cannot be applied and the cache can no longer be trusted.
+bool TreeCache::applyRemoteOperations(const json &operations, uint16_t tree, const Placeholders *placeholders)
+{
+    if (tree >= shares.size())
+    {
+        return false;
+    }
+
+    // Operations that never touch the fields the plugin keeps
+    static const unordered_set<string> ignored = {
+        "share", "unshare", "add_shared_emails", "remove_shared_emails", "add_shared_url", "remove_shared_url"};
+
+    for (const auto &operation : operations)
+    {
+        const string type = operation.value("type", "");
+        const json data = operation.value("data", json::object());
+        const string projectId = data.value("projectid", "");
+        string parentId = data.value("parentid", "");
+        if (parentId == "None")
+        {
+            parentId = tree < mountParents.size() ? mountParents[tree] : string();
+        }
+
+        if (type == "edit")
+        {
+            if (!contains(projectId))
+                return false;
+            if (data.contains("name") && data["name"].is_string())
+                setNodeName(projectId, data["name"].get<string>());
+        }
+        else if (type == "complete" || type == "uncomplete")
+        {
+            if (!setNodeCompleted(projectId, type == "complete"))
+                return false;
+        }
+        else if (type == "delete")
+        {
+            // Already gone when the delete was our own
+            eraseNode(projectId);
+        }
+        else if (type == "create")
+        {
+            json node = json::object({{"id", projectId}, {"nm", ""}});
+            if (!applyRemoteCreate(parentId, node, data.value("priority", 0), tree, placeholders))
+                return false;
+        }
+        else if (type == "bulk_create")
+        {
+            json trees;
+            try
+            {
+                trees = json::parse(data.value("project_trees", "[]"));
+            }
+            catch (const exception &e)
+            {
+                qWarning() << "Error parsing bulk_create trees:" << e.what();
+                return false;
+            }
+
+            int priority = data.value("starting_priority", 0);
+            for (const auto &project : trees)
+            {
+                if (!applyRemoteCreate(parentId, project, priority++, tree, placeholders))
+                    return false;
+            }
+        }
+        else if (type == "move")
+        {
+            // Relinked in place, subtree and all; a node cannot move below itself
+            const uint32_t index = lookup(projectId);
+            const uint32_t parent = parentIndex(parentId);
+            if (index == NoNode || parent == NoNode)
+                return false;
+            for (uint32_t above = parent; above != Root; above = nodes[above].parent)
+            {
+                if (above == index)
+                    return false;
+            }
+
+            touch();
+            unlink(index);
+            nodes[index].priority = priorityAt(parent, data.value("priority", 0));
+            link(index, parent);
+        }
+        else if (!ignored.count(type))
+        {
+            qDebug() << "Unhandled WorkFlowy operation:" << QString::fromStdString(type);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Insert a node created elsewhere. Our own creates come back here too, under the id they asked for, and replace the
+// temp placeholder made for them; a create of someone else's never touches one, whatever its name.
+bool TreeCache::applyRemoteCreate(const string &parentId, const json &project, int position, uint16_t tree, const Placeholders *placeholders)
+{
+    uint32_t parent = parentIndex(parentId);
+    if (parent == NoNode)
+    {
+        return false;
+    }
+
+    json node = remoteNode(project);
+    const string id = node.value("id", "");
+    if (id.empty())
+    {
+        return false;
+    }
+    if (contains(id))
+    {
+        return true;
+    }
+
+    if (placeholders)
+    {
+        if (auto placeholder = placeholders->find(id); placeholder != placeholders->end() && eraseNode(placeholder->second))
+        {
+            // Erasing may compact the tree and renumber the parent
+            parent = parentIndex(parentId);
+            if (parent == NoNode)
+                return false;
+        }
+    }
+
+    node["pr"] = priorityAt(parent, position);
+    insertNode(parentId, node, tree);
+    return true;
+}
+
+// Keep only the fields the plugin reads from a project tree as sent in operations ("ch" holds the children there)
+json TreeCache::remoteNode(const json &tree)
+{
+    json node = json::object({{"id", tree.value("id", "")},
+                              {"nm", tree.value("nm", "")},
+                              {"children", json::array()}});
+    if (tree.contains("cp"))
+    {
+        node["cp"] = tree["cp"];
+    }
+
+    for (const char *key : {"ch", "children"})
+    {
+        if (tree.contains(key) && tree[key].is_array())
+        {
+            int position = 0;
+            for (const auto &child : tree[key])
+            {
+                json converted = remoteNode(child);
+                converted["pr"] = position++;
+                node["children"].push_back(std::move(converted));
+            }
+        }
+    }
+    return node;
+}
+
+QString applyStrikethrough(const QString &text)
+{
+    static const QChar kStrikethroughChar(0x0336);
+    QString result;
+    for (QChar c : text)
+    {
+        result += c;
+        // After the whole code point, as the cache strikes through its UTF-8 names
+        if (!c.isHighSurrogate())
+            result += kStrikethroughChar;
+    }
+    return result;
+}
+
+// Rough heap footprint of the store and its indexes, counting container and allocation overhead the way libstdc++
+// lays them out. Walks the hash tables, so it is for `wf stats`, not for hot paths.
+size_t TreeCache::approximateBytes() const
+{
+    constexpr size_t Allocation = 16;  // malloc header and rounding
+    constexpr size_t HashNode = 8 + 8; // unordered_map node link and cached hash
+    auto stringBytes = [](const string &text)
+    { return text.capacity() > 15 ? text.capacity() + 1 + Allocation : 0; };
+
+    size_t bytes = nodes.capacity() * sizeof(Node) + strings.capacity() + 2 * Allocation;
+
+    bytes += ids.bucket_count() * sizeof(void *) + ids.size() * (HashNode + sizeof(NodeId) + sizeof(uint32_t) + 4 + Allocation);
+    bytes += internedIds.capacity() * sizeof(string) + internedSlots.bucket_count() * sizeof(void *);
+    for (const auto &id : internedIds)
+        bytes += 2 * stringBytes(id) + HashNode + sizeof(string) + sizeof(uint32_t) + Allocation;
+
+    bytes += childNames.capacity() * sizeof(uint32_t) + Allocation;
+
+    bytes += trigramIndex.bucket_count() * sizeof(void *);
+    for (const auto &[trigram, postings] : trigramIndex)
+        bytes += HashNode + sizeof(trigram) + sizeof(postings) + Allocation + postings.capacity() * sizeof(uint32_t) + Allocation;
+
+    return bytes;
+}
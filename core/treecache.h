@@ -0,0 +1,216 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <QString>
+#include <QStringList>
+
+#include "htmltext.h"
+
+using json = nlohmann::json;
+
+enum class NodeAction {
+    Create,
+    Edit,
+    Remove,
+    Complete
+};
+
+// No node: the end of a sibling list, a missing parent or child, a lookup that found nothing
+inline constexpr uint32_t NoNode = ~uint32_t(0);
+
+// 128-bit node id. WorkFlowy ids are UUIDs and are kept as their two halves; any other id (the temp- ids of
+// optimistic creates) is interned by the cache and stored as its slot, with `hi` set to Interned.
+struct NodeId {
+    static constexpr uint64_t Interned = ~uint64_t(0);
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    bool operator==(const NodeId &other) const = default;
+    static bool parseUuid(const std::string &text, NodeId &id);
+    static NodeId random();
+    std::string uuid() const;
+};
+
+struct NodeIdHash {
+    size_t operator()(const NodeId &id) const noexcept { return size_t(id.hi ^ (id.lo * 0x9e3779b97f4a7c15ull)); }
+};
+
+// One node of the compact store, a cache line each. Nodes link to each other by index: siblings form a doubly
+// linked list in listing order, and every sibling group is laid out contiguously by a rebuild. Names are UTF-8
+// ranges of the cache's string arena; the plain and folded text share the range before them when they are equal.
+// A completed node's struck-through name follows them, its range implied by the plain text.
+struct Node {
+    static constexpr uint8_t Completed = 1;
+    static constexpr uint8_t Free = 2; // removed, reclaimed by the next compaction
+
+    NodeId id;
+    uint32_t parent = NoNode;
+    uint32_t firstChild = NoNode;
+    uint32_t nextSibling = NoNode;
+    uint32_t prevSibling = NoNode;
+    uint32_t name = 0; // raw WorkFlowy name (HTML)
+    uint32_t nameLength = 0;
+    uint32_t text = 0; // plain text
+    uint32_t textLength = 0;
+    uint32_t folded = 0; // case-folded plain text
+    uint32_t foldedLength = 0;
+    int32_t priority = 0;
+    uint8_t flags = 0;
+    uint16_t tree = 0; // the tree the node belongs to, an index into TreeCache::shares
+};
+static_assert(sizeof(Node) == 64);
+
+// Undo record of one optimistic cache change, kept until the server accepts or rejects the mutation.
+// `previous` holds what the change replaced: the old name, the old completed flag or the removed subtree.
+struct JournalEntry {
+    NodeAction action;
+    std::string id;
+    std::string parentId;
+    json previous;
+    std::string share;     // tree the change is pushed to, empty for the main tree
+    std::string createdId; // for a create, the id the server is asked to give the node
+};
+
+// The WorkFlowy tree as a compact node store with its lookup indexes. Self-contained so a fresh one can be built
+// off the GUI thread and moved into place. Node indexes stay valid until the next change of the tree; anything
+// kept longer holds the id.
+struct TreeCache {
+    static constexpr uint32_t Root = 0; // nodes[Root] is the virtual parent of the top-level nodes
+
+    std::vector<Node> nodes;
+    std::string strings;
+    std::unordered_map<NodeId, uint32_t, NodeIdHash> ids;
+    std::vector<std::string> internedIds;
+    std::unordered_map<std::string, uint32_t> internedSlots;
+    size_t liveNodes = 0; // without the root
+    size_t garbage = 0;   // bytes of removed nodes and replaced names still in the arrays
+    bool loaded = false;
+
+    // Trees shared with the account, mounted into the main one. shares[0] is "" for the main tree itself.
+    static constexpr uint16_t NoTree = ~uint16_t(0);
+    std::vector<std::string> shares;
+    // Per tree, the id of the node it is mounted under, "" for the top level; where its "None" parent points
+    std::vector<std::string> mountParents;
+    uint16_t treeOf(const std::string &shareId) const;
+    const std::string &shareOf(uint32_t index) const { return shares[nodes[index].tree]; }
+
+    TreeCache() { clear(); }
+
+    // Changes with every edit of the tree. Drawn from one counter so a freshly built cache never reuses a
+    // version the one it replaces already had.
+    uint64_t version = 0;
+    inline static std::atomic<uint64_t> versions{0};
+    void touch() { version = ++versions; }
+
+    // Loading: add nodes in any order, then rebuild() once to sort, lay out and index them
+    void clear();
+    void load(const json &tree, const json &shared = json::array());
+    void addNodes(const json &children, uint32_t parent, uint16_t tree = 0);
+    uint32_t addNode(uint32_t parent, uint32_t previous, const std::string &id, const std::string &name, int priority, bool completed, uint16_t tree = 0);
+    void mount(const std::string &shareId, const json &tree);
+    // Where a shared tree's top-level nodes go while it is loaded node by node, between beginMount and endMount
+    struct Mount {
+        uint16_t tree = NoTree; // NoTree when there is no room for another tree
+        uint32_t parent = Root;
+        uint32_t existing = NoNode; // first child of the parent before the tree's nodes went in front of it
+        int priority = 0;
+    };
+    Mount beginMount(const std::string &shareId);
+    void endMount(const Mount &mount);
+    void rebuild();
+    void findMountParents();
+    void compact();
+    void reindex();
+    void compactIfSparse();
+
+    // Node access
+    size_t size() const { return liveNodes; }
+    uint32_t lookup(const std::string &id) const;
+    uint32_t parentIndex(const std::string &parentId) const { return parentId.empty() ? Root : lookup(parentId); }
+    bool contains(const std::string &id) const { return lookup(id) != NoNode; }
+    std::string idOf(uint32_t index) const;
+    std::string nodeName(uint32_t index) const;
+    std::string_view textView(uint32_t index) const;
+    std::string_view foldedView(uint32_t index) const;
+    QString nodeText(uint32_t index) const;
+    QString nodeDisplay(uint32_t index) const;
+    bool completed(uint32_t index) const { return nodes[index].flags & Node::Completed; }
+    json subtree(uint32_t index) const;
+    TreeCache copyNodes() const;
+
+    // Listed names of completed nodes, struck through once when they complete or get renamed and kept in the arena
+    static uint32_t displayOffset(const Node &node);
+    size_t displayLength(const Node &node) const;
+    void appendDisplay(uint32_t index);
+
+    // Route index: children by (parent, plain-text name) in an open-addressed table of node indexes, the key of an
+    // entry recomputed from its node. Kept by link, unlink and setNodeText for linked nodes and rebuilt by reindex;
+    // candidates are checked since different names can share a key.
+    static constexpr uint32_t RemovedChild = NoNode - 1; // tombstone, keeps probe chains intact
+    std::vector<uint32_t> childNames;
+    size_t childNamesUsed = 0; // slots holding an entry or a tombstone
+    size_t childNamesLive = 0;
+    static uint64_t childKey(uint32_t parent, std::string_view name);
+    void resizeChildNames(size_t live);
+    void addChildName(uint32_t index);
+    void removeChildName(uint32_t index);
+    uint32_t childNamed(uint32_t parent, std::string_view name) const;
+    uint32_t resolveRoute(const QStringList &route) const;
+    uint32_t findNode(const QStringList &route) const;
+    static bool listedBefore(const Node &a, const Node &b);
+
+    // Trigram inverted index over the bytes of the case-folded names for `?term` searches. Posting lists hold node
+    // indexes in increasing order and may still name nodes renamed or removed since the last rebuild, so matches
+    // are checked.
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigramIndex;
+    void addSearchTerms(uint32_t index);
+    std::vector<uint32_t> search(const QString &term, size_t limit) const;
+    QStringList pathOf(uint32_t index) const;
+    static uint32_t trigramAt(std::string_view text, size_t i);
+
+    NodeId toNodeId(const std::string &id);
+    uint32_t newNode(const std::string &id, const std::string &name, int priority, bool completed);
+    void setNodeText(uint32_t index, const std::string &name);
+    size_t stringBytes(const Node &node) const;
+    void link(uint32_t index, uint32_t parent);
+    void unlink(uint32_t index);
+    void sortChildren(uint32_t parent);
+    void indexSubtree(uint32_t index);
+    void releaseSubtree(uint32_t index);
+
+    // Placeholders of shared trees met while loading the main tree ("as" names the share), by share id
+    std::unordered_map<std::string, uint32_t> mountPoints;
+
+    uint32_t insertNode(const std::string &parentId, const json &node, uint16_t tree = NoTree);
+    bool eraseNode(const std::string &id, json *removed = nullptr);
+    size_t unmount(const std::string &shareId);
+    bool setNodeName(const std::string &id, const std::string &name);
+    bool setNodeCompleted(const std::string &id, bool completed);
+    bool renameNode(const std::string &id, const std::string &newId);
+    int priorityAt(uint32_t parent, int position) const;
+
+    // Optimistic local change for a node action, recording how to undo it in `journal`
+    bool applyLocal(NodeAction action, const json &nodeInfo, JournalEntry &journal);
+    void rollback(const JournalEntry &journal);
+    bool reapply(JournalEntry &journal, const json &value);
+    static std::string createdId(const json &operation);
+
+    // Delta sync: replay operations polled from push_and_poll for one tree. `placeholders` maps the ids our creates
+    // in flight asked for to the temp ids of their optimistic nodes, which make way for the real ones.
+    using Placeholders = std::unordered_map<std::string, std::string>;
+    bool applyRemoteOperations(const json &operations, uint16_t tree = 0, const Placeholders *placeholders = nullptr);
+    bool applyRemoteCreate(const std::string &parentId, const json &project, int position, uint16_t tree, const Placeholders *placeholders);
+    static json remoteNode(const json &tree);
+
+    size_t approximateBytes() const;
+};
+
+// Text with a combining strikethrough after every character, how completed nodes are listed
+QString applyStrikethrough(const QString &text);
@@ -17,32 +17,83 @@ Plugin::Plugin()
 {
     // Initialize plugin and timers
     setFuzzyMatching(false);
-    refreshTimer = new QTimer(this);
-    connect(refreshTimer, &QTimer::timeout, this, &Plugin::refreshCachedTree);
-    refreshTimer->start(10000);
-
-    // Initialize the CLI interface path
-    CLIPath = QString::fromStdString(findCLI());
+    setupRefreshScheduler();
+
+    // Mutations made in quick succession are pushed together
+    mutationTimer = new QTimer(this);
+    mutationTimer->setSingleShot(true);
+    mutationTimer->setInterval(MutationBatchWindow);
+    connect(mutationTimer, &QTimer::timeout, this, &Plugin::flushMutations);
+
+    // Locate the CLI without blocking startup; commands issued meanwhile wait for it
+    cliResolver.setMaxThreadCount(1);
+    resolveCLI();
+
+    // Serve queries from the last snapshot until the first sync lands
+    snapshotWriter.setMaxThreadCount(1);
+    snapshotTimer = new QTimer(this);
+    snapshotTimer->setSingleShot(true);
+    snapshotTimer->setInterval(SnapshotInterval);
+    connect(snapshotTimer, &QTimer::timeout, this, &Plugin::flushSnapshot);
+    loadSnapshot();
 
     // Get the tree initially and store in cache
     refreshCachedTree();
+    scheduleRefresh(refreshInterval);
+}
+
+// Queued mutations are pushed and their replies waited for a little, then a snapshot still waiting for its interval
+// is written before the writer thread is joined
+Plugin::~Plugin()
+{
+    refreshTimer->stop();
+    mutationTimer->stop();
+    const QDeadlineTimer deadline(ShutdownDrainTimeout);
+    QTimer::singleShot(ShutdownDrainTimeout, this, []() {}); // wakes the wait below when time is up
+    while (!outbox.drained() && !deadline.hasExpired())
+    {
+        flushMutations();
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    if (!outbox.drained())
+    {
+        qWarning("Unloading with WorkFlowy changes the server has not answered, they are lost.");
+    }
+
+    if (snapshotTimer->isActive())
+    {
+        flushSnapshot();
+    }
 }
 
 // Query handler logic
 void Plugin::handleTriggerQuery(Query &query)
 {
-    // If the tree is null, wait for it to refresh
-    if (cachedTree.is_null())
+    ScopedTiming timing(metrics.query);
+
+    // Someone is looking, keep the tree fresh. This runs on Albert's query thread, and the refresh timer and its
+    // interval belong to the GUI thread.
+    QMetaObject::invokeMethod(this, &Plugin::noteActivity, Qt::QueuedConnection);
+
+    // Instrumentation, available even while the tree is still loading
+    if (query == QStringLiteral("stats"))
+    {
+        showStats(query);
+        return;
+    }
+
+    // Everything below reads the cache, which the GUI thread may be changing
+    QReadLocker locker(&cacheLock);
+
+    // If the tree is not loaded yet, wait for it to refresh
+    if (!cache.loaded)
     {
         qWarning("Workflowy cache is empty, cannot handle query.");
         auto item = make_shared<StandardItem>(
             QStringLiteral("Refreshing"),
             QStringLiteral("Loading Workflowy tree..."),
             QString(),
-            []
-            {
-                return albert::iconFromUrl(IconUrl);
-            },
+            IconFactory,
             vector<Action>{});
         query.add(item);
         return;
@@ -56,10 +107,7 @@ void Plugin::handleTriggerQuery(Query &query)
             QStringLiteral("reauth"),
             QStringLiteral("Press enter to reauthenticate"),
             QString(),
-            []
-            {
-                return albert::iconFromUrl(IconUrl);
-            },
+            IconFactory,
             vector<Action>{
                 Action(
                     QStringLiteral("reauth"),
@@ -70,9 +118,12 @@ void Plugin::handleTriggerQuery(Query &query)
                                             {
                             if (!success) {
                                 qWarning() << "CLI failed to execute.";
-                                refreshCachedTree();
+                                requestRefresh();
                                 return;
                             }
+
+                            // The worker still holds the old session
+                            worker.stop();
                             
                             // Debug purposes
                             qDebug() << "reauth output:\n" << QString::fromStdString(output);
@@ -104,135 +155,271 @@ void Plugin::handleTriggerQuery(Query &query)
         return;
     }
 
+    // `?term` searches the whole tree instead of following a route
+    if (query.string().startsWith(QLatin1Char('?')))
+    {
+        searchNodes(query, query.string().mid(1).trimmed());
+        return;
+    }
+
     // List nodes in Albert Items
     QStringList parts = query.string().split(QLatin1Char('>'), Qt::SkipEmptyParts);
-    query.add(listNodes(parts, cachedTree));
+    listNodes(query, parts);
 }
 
-// List the nodes as Items
-vector<shared_ptr<Item>> Plugin::listNodes(QStringList route, const json &root_nodes)
+// List the nodes as Items. Rows go out in batches, the first one small so it shows up quickly, and building
+// stops as soon as Albert drops the query for a newer keystroke.
+void Plugin::listNodes(Query &query, QStringList route)
 {
+    // A folder seen since the last change to the tree is served as it was built then
+    const QString key = route.join(u'>');
+    const uint64_t version = cache.version;
+    vector<shared_ptr<Item>> listed;
+    if (listings.get(key, version, listed))
+    {
+        query.add(std::move(listed));
+        return;
+    }
+
     vector<shared_ptr<Item>> items;
 
-    // Get child nodes or display root based on the route
-    json current_nodes = route.isEmpty() ? root_nodes : getChildNodes(root_nodes, route);
+    // The folder the route leads to (the root for an empty route), read in place
+    const uint32_t parent = cache.resolveRoute(route);
     // Lambda function to create QString representation of route
     auto makePath = [](const QStringList &segments)
     {
         return segments.join(u'>');
     };
 
-    // Check if nodes exist
-    if (!current_nodes.is_null())
+    // Check if the node exists
+    if (parent != NoNode)
     {
-        // If it is an array of nodes
-        if (current_nodes.is_array())
+        // Children are kept in listing order by the cache and laid out next to each other, so this is a plain walk
+        size_t batchSize = FirstResultBatch;
+        for (uint32_t child = cache.nodes[parent].firstChild; child != NoNode; child = cache.nodes[child].nextSibling)
         {
-            // Stable sorts the nodes based on priority (Decided by WorkFlowy) (Complete nodes sync to the bottom)
-            stable_sort(current_nodes.begin(), current_nodes.end(), [](const json &a, const json &b)
-                        {
-                const bool a_cp = a.contains("cp");
-                const bool b_cp = b.contains("cp");
+            if (!query.isValid())
+            {
+                return;
+            }
 
-                if (a_cp && !b_cp) { // If a is checked and b is unchecked, b comes before a
-                    return false;
-                }
+            items.push_back(makeNodeItem(child, route));
+            listed.push_back(items.back());
+            if (items.size() == batchSize)
+            {
+                query.add(std::move(items));
+                items.clear();
+                batchSize = ResultBatch;
+            }
+        }
+    }
+    else
+    { // If the node doesn't exist
+        // Create node option
+        auto path = makePath(route);
 
-                if (!a_cp && b_cp) { // If a is unchecked and b is checked, a comes before b
-                    return true;
-                }
+        auto item = make_shared<StandardItem>(
+            path,
+            QStringLiteral("Create New Node"),
+            QStringLiteral("New node at ").append(path),
+            IconFactory,
+            vector<Action>{
+                Action(
+                    QStringLiteral("create"),
+                    QStringLiteral("Create Node"),
+                    [this, route]()
+                    { qInfo("Creating new node..."); createNode(route); })},
+            path);
+
+        items.push_back(item);
+        listed.push_back(item);
+    }
 
-                if (a_cp && b_cp) { // If a is checked and b is checked, preserve order
-                    return false;
-                }
+    if (!query.isValid())
+    {
+        return;
+    }
+    if (!items.empty())
+    {
+        query.add(std::move(items));
+    }
+    listings.put(key, version, std::move(listed));
+}
 
-                // Sort by priority if both contain priority attributes
-                if (a.contains("pr") && b.contains("pr") && a["pr"].is_number() && b["pr"].is_number()) {
-                    return a["pr"].get<int>() < b["pr"].get<int>();
-                }
+bool Plugin::ListingCache::get(const QString &route, uint64_t version, vector<shared_ptr<Item>> &items)
+{
+    lock_guard<mutex> lock(guard);
+    auto it = lookup.find(route);
+    if (it == lookup.end())
+    {
+        return false;
+    }
+    if (it->second->version != version)
+    {
+        entries.erase(it->second);
+        lookup.erase(it);
+        return false;
+    }
 
-                // Else preserve order
-                return false; });
+    entries.splice(entries.begin(), entries, it->second);
+    items = it->second->items;
+    return true;
+}
 
-            // Append the items to the list
-            for (auto &node : current_nodes)
-            {
-                const string plain = html_to_text(node["nm"].get<string>());
-                QString name = QString::fromStdString(plain);
-                QString completeLabel = QStringLiteral("Check");
+void Plugin::ListingCache::put(const QString &route, uint64_t version, vector<shared_ptr<Item>> &&items)
+{
+    lock_guard<mutex> lock(guard);
+    if (auto it = lookup.find(route); it != lookup.end())
+    {
+        entries.erase(it->second);
+        lookup.erase(it);
+    }
+
+    entries.push_front(Listing{route, version, std::move(items)});
+    lookup[route] = entries.begin();
+    if (entries.size() > Capacity)
+    {
+        lookup.erase(entries.back().route);
+        entries.pop_back();
+    }
+}
 
-                if (node.contains("cp"))
+// Item for one node listed under `route`, with the check/edit/remove actions.
+// Actions hold only the node id and look the node up when triggered.
+shared_ptr<Item> Plugin::makeNodeItem(uint32_t index, const QStringList &route)
+{
+    const string id = cache.idOf(index);
+    QString name = cache.nodeDisplay(index);
+    QString completeLabel = cache.completed(index) ? QStringLiteral("Uncheck") : QStringLiteral("Check");
+
+    QStringList newRoute = route;
+    newRoute.append(name);
+    QString path = newRoute.join(u'>');
+
+    return make_shared<StandardItem>(
+        path,          // id
+        QString(name), // text
+        path,          // subtext
+        IconFactory, // icons
+        vector<Action>{
+            // actions
+            Action(
+                QStringLiteral("tcomplete"),
+                completeLabel,
+                [this, id, newRoute]()
                 {
-                    name = applyStrikethrough(name);
-                    completeLabel = QStringLiteral("Uncheck");
-                }
+                    qInfo("Complete node...");
+                    if (const json node = nodeHandle(id); !node.is_null())
+                        toggleCompleteNode(node, newRoute);
+                }),
+            Action(
+                QStringLiteral("edit"),
+                QStringLiteral("Edit"),
+                [this, id, newRoute]()
+                {
+                    qInfo("Editing node...");
+                    if (const json node = nodeHandle(id); !node.is_null())
+                        editNode(node, newRoute);
+                }),
+            Action(
+                QStringLiteral("remove"),
+                QStringLiteral("Remove"),
+                [this, id, newRoute]()
+                {
+                    qInfo("Removing node...");
+                    if (const json node = nodeHandle(id); !node.is_null())
+                        removeNode(node, newRoute);
+                }),
+        },
+        path + QLatin1Char('>') // action text
+    );
+}
 
-                QStringList newRoute = route;
-                newRoute.append(name);
-                QString path = makePath(newRoute);
+// Search the whole tree, listing each match under the path that leads to it
+void Plugin::searchNodes(Query &query, const QString &term)
+{
+    vector<shared_ptr<Item>> items;
 
-                auto item = make_shared<StandardItem>(
-                    path,          // id
-                    QString(name), // text
-                    path,          // subtext
-                    []
-                    {
-                        return albert::iconFromUrl(IconUrl);
-                    }, // icons
-                    vector<Action>{
-                        // actions
-                        Action(
-                            QStringLiteral("tcomplete"),
-                            completeLabel,
-                            [this, node, newRoute]() mutable
-                            { qInfo("Complete node..."); toggleCompleteNode(node, newRoute); }),
-                        Action(
-                            QStringLiteral("edit"),
-                            QStringLiteral("Edit"),
-                            [this, node, newRoute]() mutable
-                            { qInfo("Editing node..."); editNode(node, newRoute); }),
-                        Action(
-                            QStringLiteral("remove"),
-                            QStringLiteral("Remove"),
-                            [this, node, newRoute, root_nodes]() mutable
-                            { qInfo("Removing node..."); removeNode(node, newRoute); }),
-                    },
-                    path + QLatin1Char('>') // action text
-                );
-
-                items.push_back(item);
-            }
-        }
-        else if (current_nodes.is_object() && html_to_text(current_nodes["err"].get<string>()) == "Not Found")
-        { // If the node doesn't exist
-            // Create node option
-            auto path = makePath(route);
-
-            auto item = make_shared<StandardItem>(
-                path,
-                QStringLiteral("Create New Node"),
-                QStringLiteral("New node at ").append(path),
-                []
-                {
-                    return albert::iconFromUrl(IconUrl);
-                },
-                vector<Action>{
-                    Action(
-                        QStringLiteral("create"),
-                        QStringLiteral("Create Node"),
-                        [this, route, root_nodes]()
-                        { qInfo("Creating new node..."); createNode(route, root_nodes); })},
-                path);
-
-            items.push_back(item);
+    for (uint32_t index : cache.search(term, SearchLimit))
+    {
+        if (!query.isValid())
+        {
+            return;
         }
+
+        QStringList route = cache.pathOf(index);
+        route.removeLast();
+        items.push_back(makeNodeItem(index, route));
     }
 
-    return items;
+    query.add(std::move(items));
+}
+
+// `wf stats`: where time has gone since the plugin loaded, one row per stage, and the size of the cache
+void Plugin::showStats(Query &query)
+{
+    const vector<Action> actions = {Action(QStringLiteral("dump"), QStringLiteral("Write stats to file"), [this]()
+                                           { writeStats(); })};
+    auto addRow = [&](const QString &title, const QString &text)
+    {
+        query.add(make_shared<StandardItem>(QStringLiteral("stats-") + title, title, text, IconFactory, actions));
+    };
+
+    for (const QString &line : statsReport())
+    {
+        const qsizetype split = line.indexOf(QStringLiteral(": "));
+        addRow(line.left(split), line.mid(split + 2));
+    }
+}
+
+QStringList Plugin::statsReport()
+{
+    QStringList lines;
+    {
+        QReadLocker locker(&cacheLock);
+        lines << QStringLiteral("tree: %1 nodes, ~%2 MB cached")
+                     .arg(qulonglong(cache.size()))
+                     .arg(cache.approximateBytes() / 1048576.0, 0, 'f', 1);
+    }
+
+    for (const auto &[name, histogram] : metrics.histograms())
+    {
+        lines << QString::fromLatin1(name) + QStringLiteral(": ") + QString::fromStdString(Metrics::describe(*histogram));
+    }
+
+    QStringList counters;
+    for (const auto &[name, value] : metrics.counters())
+    {
+        counters << QString::fromLatin1(name) + QLatin1Char(' ') + QString::number(qulonglong(value));
+    }
+    lines << QStringLiteral("counters: ") + counters.join(QStringLiteral(", "));
+    return lines;
+}
+
+// Plain text copy of `wf stats` next to the snapshot, for attaching to bug reports
+void Plugin::writeStats()
+{
+    const QString path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/AlberFlowy/stats.txt");
+    const QByteArray data = (statsReport().join(QLatin1Char('\n')) + QLatin1Char('\n')).toUtf8();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Cannot write AlberFlowy stats:" << file.errorString();
+        return;
+    }
+    file.write(data);
+    if (!file.commit())
+    {
+        qWarning() << "Cannot write AlberFlowy stats:" << file.errorString();
+        return;
+    }
+    qInfo() << "AlberFlowy stats written to" << path;
 }
 
 // Create node handler
-void Plugin::createNode(QStringList route, const json &nodes)
+void Plugin::createNode(QStringList route)
 {
     if (route.isEmpty())
     {
@@ -240,10 +427,10 @@ void Plugin::createNode(QStringList route, const json &nodes)
         return;
     }
 
-    QString name = route.takeLast();          // Retrieve new node name
-    json parentNode = findNode(nodes, route); // get the parent node object from the json nodes
+    QString name = route.takeLast();   // Retrieve new node name
+    const uint32_t parentNode = cache.findNode(route); // get the parent node from its route
 
-    QString parentID = (parentNode.is_object() && parentNode.contains("id") && !parentNode["id"].is_null()) ? QString::fromStdString(parentNode["id"].get<string>()) : QStringLiteral("None"); // Get the parent ID if the parent exists, otherwise place it at root
+    QString parentID = parentNode != NoNode ? QString::fromStdString(cache.idOf(parentNode)) : QStringLiteral("None"); // Get the parent ID if the parent exists, otherwise place it at root
 
     qDebug() << "Create:" << name << " at route:" << route.join(u'>') << " with parentID:" << parentID;
 
@@ -252,54 +439,24 @@ void Plugin::createNode(QStringList route, const json &nodes)
             {"nm", name.toStdString()},
             {"parentID", parentID.toStdString()},
         });
-    updateCachedTree(NodeAction::Create, tempNode, [](bool success) {});
-
-    runWorkflowyCommand({QStringLiteral("createNodeCustom"), name, parentID},
-                        [this](const bool success, const json &output)
-                        {
-                            if (!success)
-                            {
-                                qWarning() << "CLI failed to execute.";
-                                refreshCachedTree();
-                                return;
-                            }
-
-                            qDebug() << "createNodeCustom output:\n"
-                                     << QString::fromStdString(output.dump(2));
-
-                            if (!output.contains("results") || !output["results"].is_array() || output["results"].empty())
-                            {
-                                qWarning() << "Missing or malformed 'results' in CLI output.";
-                                refreshCachedTree();
-                                return;
-                            }
-
-                            const json &result = output["results"][0];
-                            if (!result.contains("server_run_operation_transaction_json"))
-                            {
-                                qWarning() << "Missing 'server_run_operation_transaction_json' in result.";
-                                refreshCachedTree();
-                                return;
-                            }
-
-                            try
-                            {
-                                const json txn_json = json::parse(result["server_run_operation_transaction_json"].get<string>());
-                                const auto &ops = txn_json.at("ops");
-                                const auto &trees_str = ops.at(0).at("data").at("project_trees").get<string>();
-                                const json trees = json::parse(trees_str);
-
-                                const auto &firstTree = trees.at(0);
-                                const string id = firstTree.at("id");
-                                cout << "Node created with ID: " << id << endl;
-                            }
-                            catch (const exception &e)
-                            {
-                                qWarning() << "Error parsing creation result:" << e.what();
-                            }
-
-                            refreshCachedTree();
-                        });
+    updateCachedTree(NodeAction::Create, tempNode, [this, name, parentID](bool success, JournalEntry &&journal)
+                     {
+        if (!success)
+            return;
+
+        const QString createdId = QString::fromStdString(journal.createdId);
+        queueMutation({QStringLiteral("createNodeCustom"), name, parentID, createdId}, std::move(journal),
+                      [name](bool success, const json &operation)
+                      {
+                          if (success)
+                          {
+                              cout << "Node created: " << name.toStdString() << endl;
+                          }
+                          else
+                          {
+                              qWarning() << "Create was not applied:" << QString::fromStdString(operation.dump());
+                          }
+                      }); });
 }
 
 void Plugin::editNode(const json &node, const QStringList route)
@@ -319,185 +476,748 @@ void Plugin::editNode(const json &node, const QStringList route)
     json tempNode = json::object(
         {{"id", node["id"].get<string>()},
          {"nm", newName.toStdString()}});
-    updateCachedTree(NodeAction::Edit, tempNode, [](bool success) {});
-
-    runWorkflowyCommand({QStringLiteral("editNode"), newName, QString::fromStdString(node["id"].get<string>())},
-                        [this](bool success, const json &output)
-                        {
-                            if (success && output.contains("id") && !output["id"].is_null())
-                            {
-                                qDebug() << "Node edited with ID:" << QString::fromStdString(output["id"].get<string>());
-                            }
-                            else
-                            {
-                                qWarning() << "CLI returned unexpected response or error:" << QString::fromStdString(output.dump(2));
-                            }
-
-                            refreshCachedTree();
-                        });
+    updateCachedTree(NodeAction::Edit, tempNode, [this, newName](bool success, JournalEntry &&journal)
+                     {
+        if (!success)
+            return;
+
+        const QString id = QString::fromStdString(journal.id);
+        queueMutation({QStringLiteral("editNode"), newName, id}, std::move(journal),
+                      [](bool success, const json &operation)
+                      {
+                          if (success)
+                          {
+                              qDebug() << "Node edited with ID:" << QString::fromStdString(operation.value("data", json::object()).value("projectid", ""));
+                          }
+                          else
+                          {
+                              qWarning() << "Edit was not applied:" << QString::fromStdString(operation.dump());
+                          }
+                      }); });
 }
 
 void Plugin::removeNode(const json &node, const QStringList route)
 {
     qDebug() << "Remove: " << QString::fromStdString(node["nm"].get<string>()) << " at " << route.join(u'>');
 
-    updateCachedTree(NodeAction::Remove, node, [](bool success) {});
+    updateCachedTree(NodeAction::Remove, node, [this](bool success, JournalEntry &&journal)
+                     {
+        if (!success)
+            return;
+
+        const QString id = QString::fromStdString(journal.id);
+        queueMutation({QStringLiteral("deleteNode"), id}, std::move(journal),
+                      [](bool success, const json &operation)
+                      {
+                          if (success)
+                          {
+                              cout << "Node deleted with ID:" << operation.value("data", json::object()).value("projectid", "") << endl;
+                          }
+                          else
+                          {
+                              qWarning() << "Delete was not applied:" << QString::fromStdString(operation.dump());
+                          }
+                      }); });
+}
+
+void Plugin::toggleCompleteNode(const json &node, const QStringList route)
+{
+    qDebug() << "Complete: " << QString::fromStdString(node["nm"].get<string>()) << " at " << route.join(u'>');
+
+    QString command = node.contains("cp") ? QStringLiteral("uncompleteNode") : QStringLiteral("completeNode");
+
+    updateCachedTree(NodeAction::Complete, node, [this, command](bool success, JournalEntry &&journal)
+                     {
+        if (!success)
+            return;
+
+        const QString id = QString::fromStdString(journal.id);
+        queueMutation({command, id}, std::move(journal),
+                      [](bool success, const json &operation)
+                      {
+                          if (success)
+                          {
+                              cout << "Node toggled with ID:" << operation.value("data", json::object()).value("projectid", "") << endl;
+                          }
+                          else
+                          {
+                              qWarning() << "Complete was not applied:" << QString::fromStdString(operation.dump());
+                          }
+                      }); });
+}
+
+// Hold a mutation for up to MutationBatchWindow ms so it can share one push_and_poll with any that follow
+void Plugin::queueMutation(const QStringList &args, JournalEntry &&journal, function<void(bool, const json &)> callback)
+{
+    noteActivity();
+
+    outbox.queue(Outbox::Mutation{args, std::move(journal), std::move(callback)});
+    if (!mutationTimer->isActive())
+    {
+        mutationTimer->start();
+    }
+}
+
+// Send the ready mutations of one tree as one batch; those of other trees go in the next flush. When the CLI can push
+// against our own transaction id, the reply carries everything committed since then, so the cache is brought up to
+// date from it directly; otherwise a regular sync follows.
+void Plugin::flushMutations()
+{
+    uint64_t batch = 0;
+    const QStringList args = outbox.take(batch, userId, joinedAt, transactionIds);
+    if (args.isEmpty())
+    {
+        return;
+    }
 
-    runWorkflowyCommand({QStringLiteral("deleteNode"), QString::fromStdString(node["id"].get<string>())},
-                        [this](bool success, const json &output)
+    runWorkflowyCommand(args,
+                        [this, batch](bool success, const json &output)
                         {
-                            if (!success)
+                            // The server tree moved under any sync that is still running
+                            ++treeGeneration;
+
+                            Outbox::Settlement settled;
                             {
-                                qWarning() << "CLI failed to execute.";
-                                refreshCachedTree();
-                                return;
+                                QWriteLocker locker(&cacheLock);
+                                settled = outbox.settle(batch, success, output, cache, transactionIds);
                             }
-
-                            qDebug() << "deleteNode output:\n"
-                                     << QString::fromStdString(output.dump(2));
-
-                            if (!output.contains("server_run_operation_transaction_json"))
+                            if (settled.answered)
                             {
-                                qWarning() << "Missing 'server_run_operation_transaction_json' in output.";
-                                refreshCachedTree();
-                                return;
+                                rememberSession(output.value("session", json::object()));
                             }
-
-                            try
+                            if (settled.synced)
                             {
-                                const json txn_json = json::parse(output["server_run_operation_transaction_json"].get<string>());
-                                const auto &ops = txn_json.at("ops");
-                                const string id = ops.at(0).at("data").at("projectid");
-                                cout << "Node deleted with ID:" << id << endl;
+                                lastFetched = chrono::steady_clock::now();
                             }
-                            catch (const exception &e)
+                            // Whether a timed-out batch went through shows in the next poll; anything else settled,
+                            // undone changes included, goes into the next snapshot
+                            if (settled.unknown)
+                            {
+                                requestRefresh();
+                            }
+                            else
                             {
-                                qWarning() << "Error parsing deletion result:" << e.what();
+                                saveSnapshot();
                             }
 
-                            refreshCachedTree();
+                            // Every change is already in the cache when the batch went through, the next poll catches up
+                            if (!settled.synced && settled.failed)
+                            {
+                                requestRefresh();
+                            }
+
+                            if (!outbox.empty() && !mutationTimer->isActive())
+                            {
+                                mutationTimer->start();
+                            }
                         });
 }
 
-void Plugin::toggleCompleteNode(const json &node, const QStringList route)
+// Keep the account details the CLI needs to build operations without asking the server first
+void Plugin::rememberSession(const json &session)
 {
-    qDebug() << "Complete: " << QString::fromStdString(node["nm"].get<string>()) << " at " << route.join(u'>');
+    if (session.contains("userId") && session["userId"].is_string())
+    {
+        userId = session["userId"].get<string>();
+    }
+    if (session.contains("joinedAt") && session["joinedAt"].is_string())
+    {
+        joinedAt = session["joinedAt"].get<string>();
+    }
+}
 
-    QString command = node.contains("cp") ? QStringLiteral("uncompleteNode") : QStringLiteral("completeNode");
+// What the node actions need of a node (id, name, completed) without its subtree; null once the node is gone
+json Plugin::nodeHandle(const string &id)
+{
+    const uint32_t index = cache.lookup(id);
+    if (index == NoNode)
+    {
+        qWarning() << "Node" << QString::fromStdString(id) << "is no longer in the tree.";
+        return nullptr;
+    }
 
-    updateCachedTree(NodeAction::Complete, node, [](bool success) {});
+    json handle = json::object({{"id", id}, {"nm", cache.nodeName(index)}});
+    if (cache.completed(index))
+    {
+        handle["cp"] = true;
+    }
+    return handle;
+}
 
-    runWorkflowyCommand({command, QString::fromStdString(node["id"].get<string>())},
-                        [this](bool success, const json &output)
+void Plugin::findPath(const json &nodes, const json &node)
+{
+}
+
+// Bring the cache up to date, replaying only the operations since the last known transaction when possible.
+// Only one sync runs at a time: a request arriving meanwhile attaches to it, or queues a single follow-up when the
+// cache changed after the running sync started and its result can no longer be trusted.
+void Plugin::refreshCachedTree()
+{
+    if (refreshInFlight)
+    {
+        if (treeGeneration != refreshGeneration)
+        {
+            refreshAgain = true;
+        }
+        return;
+    }
+
+    refreshInFlight = true;
+    refreshAgain = false;
+    refreshGeneration = treeGeneration;
+    refreshStarted = chrono::steady_clock::now();
+
+    if (!transactionIds.count(string()) || !cache.loaded)
+    {
+        fetchFullTree();
+        return;
+    }
+
+    // Every tree is polled in the same push_and_poll, the shared ones passed as {shareId: transactionId}
+    metrics.polls.fetch_add(1, memory_order_relaxed);
+    const uint64_t poll = outbox.beginPoll();
+    const map<string, string> startTransactionIds = transactionIds;
+    json shared = json::object();
+    for (const auto &[share, transactionId] : transactionIds)
+    {
+        if (!share.empty())
+            shared[share] = transactionId;
+    }
+
+    QStringList args = {QStringLiteral("pollChanges"), QString::fromStdString(transactionIds.at(string()))};
+    if (!userId.empty() || !shared.empty())
+    {
+        args.append(QString::fromStdString(userId));
+    }
+    if (!shared.empty())
+    {
+        args.append(QString::fromStdString(shared.dump()));
+    }
+
+    runWorkflowyCommand(args,
+                        [this, poll, startTransactionIds](bool success, const json &result)
                         {
-                            if (!success)
+                            if (!success || !result.is_object() || !result.contains("operations") || !result["operations"].is_array())
                             {
-                                qWarning() << "CLI failed to execute.";
-                                refreshCachedTree();
+                                // A transaction id may be too old to poll from, start over from a full tree next time
+                                qWarning("Failed to poll WorkFlowy changes.");
+                                if (transactionIds == startTransactionIds)
+                                {
+                                    transactionIds.clear();
+                                }
+                                backOffRefresh();
+                                finishRefresh();
                                 return;
                             }
 
-                            qDebug() << "completeNode output:\n"
-                                     << QString::fromStdString(output.dump(2));
-
-                            if (!output.contains("server_run_operation_transaction_json"))
+                            // A batch reply moved the cache past a polled transaction, these operations may already be in
+                            if (transactionIds != startTransactionIds)
                             {
-                                qWarning() << "Missing 'server_run_operation_transaction_json' in output.";
-                                refreshCachedTree();
+                                qDebug("Discarding WorkFlowy poll overtaken by a newer transaction.");
+                                refreshAgain = true;
+                                finishRefresh();
                                 return;
                             }
 
+                            // Each tree's operations with the transaction they bring it to; a shared tree missing from
+                            // the reply counts as diverged, one the server would not poll (unshared, say) is dropped
+                            vector<pair<string, const json *>> polled = {{string(), &result}};
+                            vector<string> dropped;
+                            const json polledShares = result.value("shares", json::object());
+                            for (const auto &[share, transactionId] : startTransactionIds)
+                            {
+                                if (share.empty())
+                                    continue;
+                                if (!polledShares.contains(share) || !polledShares[share].is_object())
+                                    polled.emplace_back(share, nullptr);
+                                else if (polledShares[share].contains("error"))
+                                    dropped.push_back(share);
+                                else
+                                    polled.emplace_back(share, &polledShares[share]);
+                            }
+
+                            bool applied = true;
+                            bool settledPushes = false;
+                            size_t operationCount = 0;
                             try
                             {
-                                const json txn_json = json::parse(output["server_run_operation_transaction_json"].get<string>());
-                                const auto &ops = txn_json.at("ops");
-                                const string id = ops.at(0).at("data").at("projectid");
-                                cout << "Node deleted with ID:" << id << endl;
+                                QWriteLocker locker(&cacheLock);
+                                for (const string &share : dropped)
+                                {
+                                    qWarning() << "Dropping shared WorkFlowy tree" << QString::fromStdString(share) << "that can no longer be polled:"
+                                               << QString::fromStdString(polledShares[share]["error"].dump());
+                                    settledPushes = outbox.settleFromPoll(poll, share, json::array(), cache).answered || settledPushes;
+                                    cache.unmount(share);
+                                }
+                                for (const auto &[share, tree] : polled)
+                                {
+                                    if (!tree || !tree->contains("operations") || !(*tree)["operations"].is_array())
+                                    {
+                                        applied = false;
+                                        break;
+                                    }
+                                    // Timed-out pushes first, so the operations find our creates under their real ids
+                                    const json &operations = (*tree)["operations"];
+                                    settledPushes = outbox.settleFromPoll(poll, share, operations, cache).answered || settledPushes;
+                                    if (!cache.applyRemoteOperations(operations, cache.treeOf(share), &outbox.placeholders()))
+                                    {
+                                        applied = false;
+                                        break;
+                                    }
+                                    operationCount += operations.size();
+                                }
                             }
                             catch (const exception &e)
                             {
-                                qWarning() << "Error parsing deletion result:" << e.what();
+                                applied = false;
+                                qWarning() << "Error applying WorkFlowy operations:" << e.what();
+                            }
+
+                            if (!applied)
+                            {
+                                qWarning("WorkFlowy tree cache diverged, fetching the full tree.");
+                                refreshGeneration = treeGeneration;
+                                fetchFullTree();
+                                return;
                             }
 
-                            refreshCachedTree();
+                            for (const auto &[share, tree] : polled)
+                            {
+                                if (tree->contains("transactionId") && (*tree)["transactionId"].is_string())
+                                {
+                                    transactionIds[share] = (*tree)["transactionId"].get<string>();
+                                }
+                            }
+                            for (const string &share : dropped)
+                            {
+                                transactionIds.erase(share);
+                            }
+                            lastFetched = chrono::steady_clock::now();
+                            if (operationCount > 0 || !dropped.empty() || settledPushes)
+                            {
+                                saveSnapshot();
+                            }
+                            qDebug() << "WorkFlowy tree cache synced," << operationCount << "operations applied.";
+                            finishRefresh();
                         });
 }
 
-json Plugin::findNode(const json &nodes, const QStringList &route)
+// Download the whole tree. The nodes are read into a cache as the reply is parsed, and indexing and snapshot
+// serialization happen on the reply thread too; the GUI thread only swaps the finished cache in and puts the changes still awaiting the server back on top.
+// Whatever reached the server while the fetch ran comes in with the poll that follows.
+void Plugin::fetchFullTree()
 {
-    if (route.isEmpty())
+    metrics.fullFetches.fetch_add(1, memory_order_relaxed);
+    const quint64 generation = refreshGeneration;
+    const uint64_t poll = outbox.beginPoll();
+    runWorkflowyCommandOffThread({QStringLiteral("getTreeSync")},
+                                 [this, generation, poll](bool success, json &&result, TreeCache &&tree)
+                                 {
+                                     if (!success || !result.is_object() || !result.contains("tree"))
+                                     {
+                                         qWarning("Failed to refresh WorkFlowy tree cache.");
+                                         QMetaObject::invokeMethod(this, [this]()
+                                                                   {
+                                             backOffRefresh();
+                                             finishRefresh(); }, Qt::QueuedConnection);
+                                         return;
+                                     }
+
+                                     // Shared trees are mounted into the main one, each keeping its own transaction id. One
+                                     // that could not be read is left out until the next full fetch.
+                                     for (const auto &[share, error] : result.value("failedShares", json::object()).items())
+                                     {
+                                         qWarning() << "Skipping shared WorkFlowy tree" << QString::fromStdString(share) << ":" << QString::fromStdString(error.dump());
+                                     }
+                                     const json shared = result.contains("shares") && result["shares"].is_array() ? std::move(result["shares"]) : json::array();
+                                     auto fresh = make_shared<TreeCache>(std::move(tree));
+
+                                     map<string, string> fetchedIds;
+                                     fetchedIds[string()] = (result.contains("transactionId") && result["transactionId"].is_string()) ? result["transactionId"].get<string>() : "";
+                                     for (const auto &share : shared)
+                                     {
+                                         const string shareId = share.value("shareId", "");
+                                         if (!shareId.empty() && fresh->treeOf(shareId) != TreeCache::NoTree && share.contains("transactionId") && share["transactionId"].is_string())
+                                             fetchedIds[shareId] = share["transactionId"].get<string>();
+                                     }
+                                     const QByteArray snapshot = serializeSnapshot(*fresh, fetchedIds);
+                                     const json session = result.value("session", json::object());
+
+                                     QMetaObject::invokeMethod(this, [this, fresh, fetchedIds, snapshot, session, generation, poll]()
+                                                               {
+                                         rememberSession(session);
+                                         size_t stale = 0;
+                                         {
+                                             QWriteLocker locker(&cacheLock);
+                                             cache = std::move(*fresh);
+                                             outbox.settleFromTree(poll, cache);
+                                             stale = outbox.replay(cache);
+                                         }
+                                         if (stale > 0) {
+                                             qDebug() << stale << "pending WorkFlowy changes no longer apply to the fetched tree.";
+                                         }
+                                         if (generation != treeGeneration) {
+                                             refreshAgain = true;
+                                         }
+                                         transactionIds = fetchedIds;
+                                         lastFetched = chrono::steady_clock::now();
+                                         snapshotTimer->stop();
+                                         writeSnapshot(snapshot);
+                                         qInfo("WorkFlowy tree cache refreshed.");
+                                         finishRefresh(); }, Qt::QueuedConnection);
+                                 },
+                                 FullFetchTimeout);
+}
+
+// The running sync is done; start the follow-up if one was asked for while it ran
+void Plugin::finishRefresh()
+{
+    metrics.refresh.recordSince(refreshStarted);
+    refreshInFlight = false;
+    if (refreshAgain)
     {
-        return json::object({{"err", "Empty route"}});
+        refreshAgain = false;
+        requestRefresh();
     }
+}
 
-    QString currentName = route[0];
-    QStringList remaining = route.mid(1);
+// Refresh scheduling: poll every minRefreshInterval ms while Albert is in use, double the interval on every idle or
+// failed tick up to maxRefreshInterval, and stop while the network is down. Both bounds are read from the plugin
+// settings (refresh/minInterval, refresh/maxInterval, in milliseconds).
+void Plugin::setupRefreshScheduler()
+{
+    QSettings settings(QStringLiteral("albert"), QStringLiteral("AlberFlowy"));
+    minRefreshInterval = max(1000, settings.value(QStringLiteral("refresh/minInterval"), DefaultMinRefreshInterval).toInt());
+    maxRefreshInterval = max(minRefreshInterval, settings.value(QStringLiteral("refresh/maxInterval"), DefaultMaxRefreshInterval).toInt());
+    refreshInterval = minRefreshInterval;
 
-    for (const auto &node : nodes)
+    refreshTimer = new QTimer(this);
+    refreshTimer->setSingleShot(true);
+    connect(refreshTimer, &QTimer::timeout, this, &Plugin::onRefreshTimer);
+
+    if (QNetworkInformation::loadDefaultBackend() && QNetworkInformation::instance())
     {
-        QString nodeName = QString::fromStdString(html_to_text(node["nm"].get<string>()));
-        if (nodeName == currentName)
-        {
-            if (remaining.isEmpty())
-            {
-                return node;
-            }
-            if (node.contains("children"))
-            {
-                return findNode(node["children"], remaining);
-            }
-            else
-            {
-                return json::object({{"err", "No further children"}});
-            }
-        }
+        connect(QNetworkInformation::instance(), &QNetworkInformation::reachabilityChanged, this, [this](QNetworkInformation::Reachability reachability)
+                {
+            const bool down = reachability == QNetworkInformation::Reachability::Disconnected;
+            if (down == networkDown)
+                return;
+
+            networkDown = down;
+            if (networkDown) {
+                qInfo("Network down, pausing WorkFlowy refresh.");
+                refreshTimer->stop();
+            } else {
+                qInfo("Network back, resuming WorkFlowy refresh.");
+                refreshInterval = minRefreshInterval;
+                requestRefresh();
+            } });
     }
+}
 
-    return json::object({{"err", "Not Found"}});
+void Plugin::onRefreshTimer()
+{
+    if (networkDown)
+    {
+        return;
+    }
+
+    refreshCachedTree();
+
+    refreshInterval = activitySinceRefresh ? minRefreshInterval : min(refreshInterval * 2, maxRefreshInterval);
+    activitySinceRefresh = false;
+    scheduleRefresh(refreshInterval);
 }
 
-void Plugin::findPath(const json &nodes, const json &node)
+// Run the next refresh in `delay` ms unless one is already due sooner
+void Plugin::scheduleRefresh(int delay)
+{
+    if (networkDown)
+    {
+        return;
+    }
+
+    if (!refreshTimer->isActive() || refreshTimer->remainingTime() > delay)
+    {
+        refreshTimer->start(delay);
+    }
+}
+
+// Ask for a refresh soon; requests arriving within RefreshCoalesceDelay of each other share one
+void Plugin::requestRefresh()
 {
+    activitySinceRefresh = true;
+    scheduleRefresh(RefreshCoalesceDelay);
 }
 
-json Plugin::getChildNodes(const json &nodes, const QStringList &route)
+// A query or mutation happened: poll at the fastest rate again. GUI thread only, like every refresh timer change.
+void Plugin::noteActivity()
 {
-    if (route.isEmpty())
+    activitySinceRefresh = true;
+    refreshInterval = minRefreshInterval;
+    scheduleRefresh(minRefreshInterval);
+}
+
+// A refresh failed: wait longer before the next attempt
+void Plugin::backOffRefresh()
+{
+    refreshInterval = min(refreshInterval * 2, maxRefreshInterval);
+    if (refreshTimer->isActive())
+    {
+        refreshTimer->start(refreshInterval);
+    }
+}
+
+QString Plugin::snapshotPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/AlberFlowy/tree.snapshot");
+}
+
+// Snapshot layout (QDataStream, big endian): magic, version, the tree count and every tree's share id and transaction
+// id (the main tree first, with an empty share id), then the nodes depth first as id, name, priority, completed
+// flag, tree and child count. Only the fields the plugin reads are stored.
+bool Plugin::loadSnapshot()
+{
+    QFile file(snapshotPath());
+    if (!file.open(QIODevice::ReadOnly))
     {
-        return nodes;
+        return false;
     }
 
-    QString currentName = route[0];
-    QStringList remaining = route.mid(1);
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
 
-    for (const auto &node : nodes)
+    quint32 magic = 0, version = 0, treeCount = 0;
+    in >> magic >> version;
+    if (magic != SnapshotMagic || version != SnapshotVersion)
     {
-        QString nodeName = QString::fromStdString(html_to_text(node["nm"].get<string>()));
-        if (nodeName == currentName && node.contains("children"))
+        qWarning("Ignoring WorkFlowy snapshot with an unknown format.");
+        return false;
+    }
+
+    TreeCache restored;
+    map<string, string> restoredIds;
+    in >> treeCount;
+    if (treeCount == 0 || treeCount >= TreeCache::NoTree)
+    {
+        qWarning("Ignoring corrupt WorkFlowy snapshot.");
+        return false;
+    }
+    restored.shares.clear();
+    for (quint32 i = 0; i < treeCount && in.status() == QDataStream::Ok; ++i)
+    {
+        QByteArray share, transactionId;
+        in >> share >> transactionId;
+        restored.shares.push_back(share.toStdString());
+        if (!transactionId.isEmpty())
+            restoredIds[share.toStdString()] = transactionId.toStdString();
+    }
+
+    if (restored.shares.size() != treeCount || !restored.shares.front().empty() || !readSnapshotNodes(in, restored, TreeCache::Root, 0) || in.status() != QDataStream::Ok)
+    {
+        qWarning("Ignoring corrupt WorkFlowy snapshot.");
+        return false;
+    }
+
+    restored.rebuild();
+    QWriteLocker locker(&cacheLock);
+    cache = std::move(restored);
+    transactionIds = std::move(restoredIds);
+    qInfo() << "Loaded WorkFlowy snapshot with" << cache.size() << "nodes.";
+    return true;
+}
+
+// Write the cache within SnapshotInterval ms, together with whatever else changes until then
+void Plugin::saveSnapshot()
+{
+    if (!snapshotTimer->isActive())
+    {
+        snapshotTimer->start();
+    }
+}
+
+void Plugin::flushSnapshot()
+{
+    // Try again later rather than write changes that may still be undone
+    if (!outbox.idle())
+    {
+        snapshotTimer->start();
+        return;
+    }
+
+    snapshotTimer->stop();
+    auto copy = make_shared<const TreeCache>(cache.copyNodes());
+    (void)QtConcurrent::run(&snapshotWriter, [path = snapshotPath(), copy, transactionIds = transactionIds]()
+                            { writeSnapshotFile(path, serializeSnapshot(*copy, transactionIds)); });
+}
+
+QByteArray Plugin::serializeSnapshot(const TreeCache &tree, const map<string, string> &transactionIds)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << SnapshotMagic << SnapshotVersion << static_cast<quint32>(tree.shares.size());
+    for (const string &share : tree.shares)
+    {
+        const auto known = transactionIds.find(share);
+        out << QByteArray::fromStdString(share) << QByteArray::fromStdString(known == transactionIds.end() ? string() : known->second);
+    }
+    writeSnapshotNodes(out, tree, TreeCache::Root);
+    return data;
+}
+
+// Write and atomically replace the file on the snapshot thread
+void Plugin::writeSnapshot(const QByteArray &data)
+{
+    (void)QtConcurrent::run(&snapshotWriter, [path = snapshotPath(), data]()
+                            { writeSnapshotFile(path, data); });
+}
+
+void Plugin::writeSnapshotFile(const QString &path, const QByteArray &data)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Cannot write WorkFlowy snapshot:" << file.errorString();
+        return;
+    }
+    file.write(data);
+    if (!file.commit())
+    {
+        qWarning() << "Cannot write WorkFlowy snapshot:" << file.errorString();
+    }
+}
+
+void Plugin::writeSnapshotNodes(QDataStream &out, const TreeCache &tree, uint32_t parent)
+{
+    quint32 count = 0;
+    for (uint32_t child = tree.nodes[parent].firstChild; child != NoNode; child = tree.nodes[child].nextSibling)
+    {
+        ++count;
+    }
+    out << count;
+
+    for (uint32_t child = tree.nodes[parent].firstChild; child != NoNode; child = tree.nodes[child].nextSibling)
+    {
+        out << QByteArray::fromStdString(tree.idOf(child))
+            << QByteArray::fromStdString(tree.nodeName(child))
+            << static_cast<qint32>(tree.nodes[child].priority)
+            << static_cast<quint8>(tree.completed(child) ? 1 : 0)
+            << static_cast<quint16>(tree.nodes[child].tree);
+        writeSnapshotNodes(out, tree, child);
+    }
+}
+
+// Read the nodes straight into the store; the caller rebuilds it once everything is in
+bool Plugin::readSnapshotNodes(QDataStream &in, TreeCache &tree, uint32_t parent, int depth)
+{
+    // WorkFlowy nests far less than this; deeper means the file is damaged
+    if (depth > 1000)
+    {
+        return false;
+    }
+
+    quint32 count = 0;
+    in >> count;
+    uint32_t previous = NoNode;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+    {
+        QByteArray id, name;
+        qint32 priority = 0;
+        quint8 completed = 0;
+        quint16 treeIndex = 0;
+        in >> id >> name >> priority >> completed >> treeIndex;
+        if (treeIndex >= tree.shares.size())
         {
-            return getChildNodes(node["children"], remaining);
+            return false;
+        }
+
+        previous = tree.addNode(parent, previous, id.toStdString(), name.toStdString(), priority, completed, treeIndex);
+        if (!readSnapshotNodes(in, tree, previous, depth + 1))
+        {
+            return false;
         }
     }
 
-    return json::object({{"err", "Not Found"}});
+    return in.status() == QDataStream::Ok;
 }
 
-void Plugin::refreshCachedTree()
+// Use the CLI found on an earlier launch if it is still in place, otherwise search for it on cliResolver.
+// ALBERFLOWY_CLI overrides the search, e.g. to run against a stand-in server (see api/fake-workflowy-server.js), and
+// is never remembered; WORKFLOWY_API_BASE reaches the CLI through its environment.
+void Plugin::resolveCLI()
 {
-    runWorkflowyCommand({QStringLiteral("getTree")},
-                        [this](bool success, const json &result)
-                        {
-                            if (success)
-                            {
-                                cachedTree = result;
-                                lastFetched = chrono::steady_clock::now();
-                                qInfo("WorkFlowy tree cache refreshed.");
-                            }
-                            else
+    const QString overridePath = qEnvironmentVariable("ALBERFLOWY_CLI");
+    if (overridePath.isEmpty() && loadResolvedCLI())
+    {
+        return;
+    }
+
+    resolvingCLI = true;
+    (void)QtConcurrent::run(&cliResolver, [this, overridePath]()
                             {
-                                qWarning("Failed to refresh WorkFlowy tree cache.");
-                            }
-                        });
+        const QString path = overridePath.isEmpty() ? QString::fromStdString(findCLI()) : overridePath;
+        const QProcessEnvironment environment = commandEnvironment();
+        const QString node = findNode(environment.value(QStringLiteral("PATH")));
+
+        QMetaObject::invokeMethod(this, [this, path, environment, node, remember = overridePath.isEmpty()]()
+                                  {
+            CLIPath = path;
+            cliEnvironment = environment;
+            nodePath = node;
+            resolvingCLI = false;
+
+            if (remember && !CLIPath.isEmpty())
+            {
+                QSettings settings(QStringLiteral("albert"), QStringLiteral("AlberFlowy"));
+                settings.setValue(QStringLiteral("cli/path"), CLIPath);
+                settings.setValue(QStringLiteral("cli/searchPath"), cliEnvironment.value(QStringLiteral("PATH")));
+            }
+
+            vector<function<void()>> waiting;
+            waiting.swap(waitingForCLI);
+            for (auto &task : waiting)
+            {
+                task();
+            } }, Qt::QueuedConnection); });
+}
+
+// The CLI path and PATH remembered from the last search, if the CLI is still executable and, unless npx runs it,
+// node is still on that PATH
+bool Plugin::loadResolvedCLI()
+{
+    QSettings settings(QStringLiteral("albert"), QStringLiteral("AlberFlowy"));
+    const QString path = settings.value(QStringLiteral("cli/path")).toString();
+    const QString searchPath = settings.value(QStringLiteral("cli/searchPath")).toString();
+    if (path.isEmpty() || searchPath.isEmpty())
+    {
+        return false;
+    }
+
+    const QFileInfo cli(path);
+    const QString node = findNode(searchPath);
+    if (!cli.exists() || !cli.isExecutable() || (!path.endsWith(QStringLiteral("/npx")) && !QFileInfo(node).isAbsolute()))
+    {
+        qInfo() << "Remembered workflowy CLI" << path << "is gone, searching again.";
+        settings.remove(QStringLiteral("cli"));
+        return false;
+    }
+
+    CLIPath = path;
+    nodePath = node;
+    cliEnvironment = QProcessEnvironment::systemEnvironment();
+    cliEnvironment.insert(QStringLiteral("PATH"), searchPath);
+    qDebug() << "Using remembered workflowy CLI at:" << CLIPath;
+    return true;
+}
+
+// Absolute path of node on the given PATH, so the CLI runs with the node found there rather than whichever one
+// Albert's own PATH has; plain "node" if there is none
+QString Plugin::findNode(const QString &searchPath)
+{
+    const QString node = QStandardPaths::findExecutable(QStringLiteral("node"), searchPath.split(QLatin1Char(':'), Qt::SkipEmptyParts));
+    return node.isEmpty() ? QStringLiteral("node") : node;
 }
 
 string Plugin::findCLI()
@@ -639,22 +1359,22 @@ string Plugin::findCLI()
     FILE *pipe = popen(command.c_str(), "r");
     if (pipe)
     {
+        string result;
         if (fgets(buffer, sizeof(buffer), pipe))
         {
-            string result = buffer;
+            result = buffer;
             if (!result.empty() && result.back() == '\n')
             {
                 result.pop_back();
             }
-            pclose(pipe);
-            if (isExecutable(result))
-            {
-                pclose(pipe);
-                qDebug() << "Found workflowy via which at:" << QString::fromStdString(result);
-                return result;
-            }
         }
         pclose(pipe);
+
+        if (!result.empty() && isExecutable(result))
+        {
+            qDebug() << "Found workflowy via which at:" << QString::fromStdString(result);
+            return result;
+        }
     }
 
     for (const string &path : nodePaths)
@@ -674,53 +1394,69 @@ string Plugin::findCLI()
     return "";
 }
 
-string Plugin::html_to_text(const string &in)
+// Run a CLI command, through the long-lived worker process unless it has to run on its own.
+// The callback is invoked on the GUI thread; `timeout` is in ms, CliWorker::NoTimeout for none.
+void Plugin::runWorkflowyCommand(const QStringList &args, function<void(bool, const json &)> callback, int timeout)
 {
-    if (in.find('<') == string::npos)
+    // Auth drives a browser login and prints plain text, so it keeps a process of its own
+    if (args.isEmpty() || args.first() == QStringLiteral("auth"))
     {
-        return in;
+        spawnWorkflowyCommand(args, callback);
+        return;
     }
 
-    GumboOutput *g = gumbo_parse(in.c_str());
-    string out;
+    runWorkflowyCommandOffThread(args, [this, callback](bool success, json &&result, TreeCache &&)
+                                 { QMetaObject::invokeMethod(this, [callback, success, result = std::move(result)]()
+                                                             { callback(success, result); }, Qt::QueuedConnection); }, timeout);
+}
 
-    function<void(GumboNode *)> walk = [&](GumboNode *n)
+// Send a command to the worker. The handler runs on the reply thread right after the reply is parsed,
+// so it may do heavy work on the result before handing anything to the GUI thread.
+void Plugin::runWorkflowyCommandOffThread(const QStringList &args, ReplyHandler handler, int timeout)
+{
+    if (resolvingCLI)
     {
-        switch (n->type)
-        {
-        case GUMBO_NODE_TEXT:
-        case GUMBO_NODE_WHITESPACE:
-            out.append(n->v.text.text);
-            break;
-        case GUMBO_NODE_ELEMENT:
-            for (size_t i = 0; i < n->v.element.children.length; ++i)
-                walk(static_cast<GumboNode *>(n->v.element.children.data[i]));
-            break;
-        default:
-            break;
-        }
+        waitingForCLI.push_back([this, args, handler = std::move(handler), timeout]() mutable
+                                { runWorkflowyCommandOffThread(args, std::move(handler), timeout); });
+        return;
+    }
+
+    metrics.commands.fetch_add(1, memory_order_relaxed);
+    handler = [handler = std::move(handler), start = chrono::steady_clock::now()](bool success, json &&result, TreeCache &&tree)
+    {
+        metrics.command.recordSince(start);
+        if (!success)
+            metrics.commandFailures.fetch_add(1, memory_order_relaxed);
+        handler(success, std::move(result), std::move(tree));
     };
-    walk(g->root);
-    gumbo_destroy_output(&kGumboDefaultOptions, g);
-    return out;
+
+    if (!worker.running() && !startWorker())
+    {
+        handler(false, json::object({{"error", "No CLI path found"}}), TreeCache());
+        return;
+    }
+
+    worker.sendForTree(args, std::move(handler), timeout);
 }
 
-QString Plugin::applyStrikethrough(const QString &text)
+// Start `workflowy serve`, which answers newline-delimited JSON requests tagged with the id they were sent with
+bool Plugin::startWorker()
 {
-    static const QChar kStrikethroughChar(0x0336);
-    QString result;
-    for (QChar c : text)
+    QString executable;
+    QStringList processArgs;
+    if (!resolveCommand({QStringLiteral("serve")}, executable, processArgs))
     {
-        result += c;
-        result += kStrikethroughChar;
+        return false;
     }
-    return result;
+
+    worker.start(executable, processArgs, cliEnvironment);
+    return true;
 }
 
-void Plugin::runWorkflowyCommand(const QStringList &args, function<void(bool, const json &)> callback)
+// Environment for CLI processes, with the usual Node version manager locations on PATH. Scans the disk, so it is
+// built once by resolveCLI rather than per command.
+QProcessEnvironment Plugin::commandEnvironment()
 {
-    QProcess *process = new QProcess(this);
-
     QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
     QString homeDir = QDir::homePath();
 
@@ -750,41 +1486,59 @@ void Plugin::runWorkflowyCommand(const QStringList &args, function<void(bool, co
         }
     }
     env.insert(QStringLiteral("PATH"), currentPath);
+    return env;
+}
 
-    process->setProcessEnvironment(env);
-
-    QString executable;
-    QStringList processArgs;
-
+// Work out how to launch the CLI found by resolveCLI()
+bool Plugin::resolveCommand(const QStringList &args, QString &executable, QStringList &processArgs)
+{
     if (CLIPath.endsWith(QStringLiteral("/npx")))
     {
         executable = CLIPath;
         processArgs = QStringList{QStringLiteral("workflowy")} + args;
     }
-    else if (CLIPath.endsWith(QStringLiteral("/workflowy")))
-    {
-        executable = QStringLiteral("node");
-        processArgs = QStringList{CLIPath} + args;
-    }
     else if (!CLIPath.isEmpty())
     {
-        executable = QStringLiteral("node");
+        executable = nodePath;
         processArgs = QStringList{CLIPath} + args;
     }
     else
     {
         qWarning("No workflowy CLI path found, cannot execute command");
+        return false;
+    }
+    return true;
+}
+
+// One-off CLI process for a single command
+void Plugin::spawnWorkflowyCommand(const QStringList &args, function<void(bool, const json &)> callback)
+{
+    if (resolvingCLI)
+    {
+        waitingForCLI.push_back([this, args, callback]()
+                                { spawnWorkflowyCommand(args, callback); });
+        return;
+    }
+
+    QString executable;
+    QStringList processArgs;
+    if (!resolveCommand(args, executable, processArgs))
+    {
         callback(false, json::object({{"error", "No CLI path found"}}));
-        process->deleteLater();
         return;
     }
 
+    QProcess *process = new QProcess(this);
+    process->setProcessEnvironment(cliEnvironment);
+    metrics.processesSpawned.fetch_add(1, memory_order_relaxed);
+
     QObject::connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [=](int exitCode, QProcess::ExitStatus exitStatus)
                      {
         (void) exitCode;
         (void) exitStatus;
         QByteArray stdoutData = process->readAllStandardOutput();
         QByteArray stderrData = process->readAllStandardError();
+        metrics.bytesRead.fetch_add(stdoutData.size(), memory_order_relaxed);
 
         qDebug() << "[workflowy-cli stdout]" << stdoutData;
         qDebug() << "[workflowy-cli stderr]" << stderrData;
@@ -817,158 +1571,19 @@ void Plugin::runWorkflowyCommand(const QStringList &args, function<void(bool, co
     process->start(executable, processArgs);
 }
 
-void Plugin::updateCachedTree(NodeAction action, const json &NodeInfo, function<void(bool)> callback)
+void Plugin::updateCachedTree(NodeAction action, const json &NodeInfo, function<void(bool, JournalEntry &&)> callback)
 {
-    // Helper to find a node by ID and return a pointer to it
-    function<json *(json &, const string &)> findNodeById = [&](json &nodes, const string &id) -> json *
-    {
-        if (!nodes.is_array())
-            return nullptr;
-        for (auto &node : nodes)
-        {
-            if (node.contains("id") && node["id"].get<string>() == id)
-            {
-                return &node;
-            }
-            if (node.contains("children"))
-            {
-                if (auto ptr = findNodeById(node["children"], id))
-                {
-                    return ptr;
-                }
-            }
-        }
-        return nullptr;
-    };
+    // Any sync already running started from a tree without this change
+    ++treeGeneration;
 
-    switch (action)
+    JournalEntry journal;
+    bool status;
     {
-    case NodeAction::Create:
-    {
-        // NodeInfo must include "nm" and optional "parentId"
-        string name = NodeInfo.value("nm", "");
-        string parentId = NodeInfo.value("parentID", "");
-        json *targetArr = &cachedTree;
-
-        if (parentId != "None")
-        {
-            if (auto parentNode = findNodeById(cachedTree, parentId))
-            {
-                if (!parentNode->contains("children") || !(*parentNode)["children"].is_array())
-                {
-                    (*parentNode)["children"] = json::array();
-                }
-                targetArr = &(*parentNode)["children"];
-            }
-        }
-
-        // Create temporary placeholder
-        string tempId = "temp-" + to_string(
-                                      chrono::steady_clock::now().time_since_epoch().count());
-        json newNode;
-        newNode["nm"] = name;
-        newNode["id"] = tempId;
-        newNode["children"] = json::array();
-        newNode["pr"] = 0;
-        targetArr->push_back(newNode);
-
-        cout << "Create node in cache named " << NodeInfo["nm"].get<string>() << " with status " << true << endl;
-
-        callback(true);
-        break;
+        ScopedTiming timing(metrics.mutation);
+        QWriteLocker locker(&cacheLock);
+        status = cache.applyLocal(action, NodeInfo, journal);
     }
-    case NodeAction::Remove:
-    {
-        // NodeInfo includes full "id"
-        string targetId = NodeInfo.value("id", "");
-        function<bool(json &)> removeRec = [&](json &nodes)
-        {
-            if (!nodes.is_array())
-                return false;
-            for (auto it = nodes.begin(); it != nodes.end(); ++it)
-            {
-                if ((*it).contains("id") && (*it)["id"].get<string>() == targetId)
-                {
-                    nodes.erase(it);
-                    return true;
-                }
-            }
-            for (auto &node : nodes)
-            {
-                if (node.contains("children") && removeRec(node["children"]))
-                {
-                    return true;
-                }
-            }
-            return false;
-        };
-        bool status = removeRec(cachedTree);
-        cout << "Remote node in cache named " << NodeInfo["nm"].get<string>() << " with status " << status << endl;
-        callback(status);
-        break;
-    }
-    case NodeAction::Complete:
-    {
-        // NodeInfo includes full "id"
-        string targetId = NodeInfo.value("id", "");
-        function<bool(json &)> toggleRec = [&](json &nodes)
-        {
-            if (!nodes.is_array())
-                return false;
-            for (auto &node : nodes)
-            {
-                if (node.contains("id") && node["id"].get<string>() == targetId)
-                {
-                    if (node.contains("cp"))
-                        node.erase("cp");
-                    else
-                        node["cp"] = true;
-                    return true;
-                }
-                if (node.contains("children") && toggleRec(node["children"]))
-                {
-                    return true;
-                }
-            }
-            return false;
-        };
-        bool status = toggleRec(cachedTree);
-        cout << "Complete node in cache named " << NodeInfo["nm"].get<string>() << " with status " << status << endl;
-        callback(status);
-        break;
-    }
-    case NodeAction::Edit:
-    {
-        // NodeInfo includes full "id" and new "nm"
-        string targetId = NodeInfo.value("id", "");
-        string newName = NodeInfo.value("nm", "");
-        function<bool(json &)> editNode = [&](json &nodes)
-        {
-            if (!nodes.is_array())
-                return false;
-            for (auto &node : nodes)
-            {
-                if (node.contains("id") && node["id"].get<string>() == targetId)
-                {
-                    node["nm"] = newName;
-                    return true;
-                }
-                if (node.contains("children") && editNode(node["children"]))
-                {
-                    return true;
-                }
-            }
-            return false;
-        };
-        bool status = editNode(cachedTree);
-
-        cout << "Edit node in cache named " << NodeInfo["nm"].get<string>() << " with status " << status << endl;
 
-        callback(status);
-        break;
-    }
-    default:
-        callback(false);
-        break;
-    }
-}
\ No newline at end of file
+    cout << "Update node in cache named " << NodeInfo.value("nm", "") << " with status " << status << endl;
+    callback(status, std::move(journal));
+}
@@ -16,9 +16,14 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <list>
 
 #include <nlohmann/json.hpp>
-#include <gumbo.h>
 #include <sys/stat.h>
 #include <pwd.h>
 #include <unistd.h>
@@ -33,6 +38,21 @@
 #include <QLineEdit>
 #include <QDir>
 #include <QSettings>
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QReadWriteLock>
+#include <QtConcurrent>
+#include <QNetworkInformation>
+#include <QDeadlineTimer>
+#include <QCoreApplication>
+
+#include "treecache.h"
+#include "cliworker.h"
+#include "metrics.h"
+#include "outbox.h"
 
 using namespace albert;
 using namespace std;
@@ -45,37 +65,151 @@ class Plugin : public util::ExtensionPlugin, public TriggerQueryHandler {
 
     public:
         Plugin();
+        ~Plugin() override;
         void handleTriggerQuery(Query &query) override;
 
     private:
         inline static const QString IconUrl = QStringLiteral("/usr/lib/x86_64-linux-gnu/albert/AlberFlowy/icon.png");
-        enum class NodeAction {
-            Create,
-            Edit,
-            Remove,
-            Complete
+        // One icon factory shared by every item
+        inline static const function<decltype(albert::iconFromUrl(IconUrl))()> IconFactory = []
+        { return albert::iconFromUrl(IconUrl); };
+
+        // Rows are handed to Albert FirstResultBatch at first, then ResultBatch at a time
+        static constexpr size_t FirstResultBatch = 50;
+        static constexpr size_t ResultBatch = 250;
+        void listNodes(Query &query, QStringList route);
+
+        // Most recently listed folders by route, valid while the tree is at the version they were built from
+        class ListingCache {
+            public:
+                static constexpr size_t Capacity = 16;
+                bool get(const QString &route, uint64_t version, vector<shared_ptr<Item>> &items);
+                void put(const QString &route, uint64_t version, vector<shared_ptr<Item>> &&items);
+
+            private:
+                struct Listing {
+                    QString route;
+                    uint64_t version;
+                    vector<shared_ptr<Item>> items;
+                };
+                mutex guard;
+                list<Listing> entries;
+                unordered_map<QString, list<Listing>::iterator> lookup;
         };
+        ListingCache listings;
+        shared_ptr<Item> makeNodeItem(uint32_t index, const QStringList &route);
+        static constexpr size_t SearchLimit = 50;
+        void searchNodes(Query &query, const QString &term);
+
+        // `wf stats`, from the process-wide metrics in metrics.h
+        void showStats(Query &query);
+        QStringList statsReport();
+        void writeStats();
         
-        vector<shared_ptr<Item>> listNodes(QStringList route, const json &root_nodes);
-        
-        void createNode(QStringList route, const json &nodes);
+        void createNode(QStringList route);
         void editNode(const json &node, const QStringList route);
         void removeNode(const json &node, const QStringList route);
         void toggleCompleteNode(const json &node, const QStringList route);
 
-        json findNode(const json &nodes, const QStringList &route);
+        // Mutations issued within MutationBatchWindow ms of the first go out as one `pushBatch` call, one per tree.
+        // Mutations naming a node whose create is unanswered wait in the outbox until it resolves.
+        static constexpr int MutationBatchWindow = 150;
+        static constexpr int ShutdownDrainTimeout = 5000; // how long unloading waits for pushes still on their way
+        QTimer *mutationTimer;
+        Outbox outbox;
+        void queueMutation(const QStringList &args, JournalEntry &&journal, function<void(bool success, const json &operation)> callback);
+        void flushMutations();
+
+        // Account details returned with the tree; with transactionIds they let a write skip get_initialization_data
+        string userId;
+        string joinedAt;
+        void rememberSession(const json &session);
+
+        json nodeHandle(const string &id);
         void findPath(const json &nodes, const json &node);
-        json getChildNodes(const json &nodes, const QStringList &route);
 
+        // Changed only on the GUI thread, which holds cacheLock for writing while it does; queries read it from
+        // Albert's query thread under cacheLock for reading. Reads on the GUI thread need no lock.
+        TreeCache cache;
+        QReadWriteLock cacheLock;
+
+        // Adaptive refresh: fast while in use, exponential back-off while idle or failing, paused while offline
+        static constexpr int DefaultMinRefreshInterval = 5000;
+        static constexpr int DefaultMaxRefreshInterval = 300000;
+        static constexpr int RefreshCoalesceDelay = 300;
         QTimer *refreshTimer;
-        json cachedTree;
+        int minRefreshInterval = DefaultMinRefreshInterval;
+        int maxRefreshInterval = DefaultMaxRefreshInterval;
+        int refreshInterval = DefaultMinRefreshInterval;
+        bool activitySinceRefresh = false;
+        bool networkDown = false;
+        void setupRefreshScheduler();
+        void onRefreshTimer();
+        void scheduleRefresh(int delay);
+        void requestRefresh();
+        void noteActivity();
+        void backOffRefresh();
+
+        // Single-flight sync. treeGeneration counts changes made to the cache or the server tree outside of a sync;
+        // a sync remembers the generation it started at so a stale poll is rejected and a stale full fetch, which keeps
+        // the pending changes on top, is followed by a poll.
+        quint64 treeGeneration = 0;
+        quint64 refreshGeneration = 0;
+        bool refreshInFlight = false;
+        bool refreshAgain = false;
+        std::chrono::steady_clock::time_point refreshStarted;
+        void finishRefresh();
+
+        // Delta sync: the transaction each tree of the cache is current as of, by share id ("" for the main tree),
+        // advanced by replaying polled operations. A full tree can take minutes to download, so its fetch gets a
+        // limit of its own rather than the worker's per-request default.
+        static constexpr int FullFetchTimeout = 600000;
+        map<string, string> transactionIds;
+        void fetchFullTree();
+
+        // Last good tree on disk so queries work before the first fetch completes. Changes from polls and settled pushes
+        // are saved at most every SnapshotInterval ms and on unload, serialized on the writer thread from a copy of the
+        // nodes. Only a cache with no change awaiting the server is written, so a snapshot never holds an optimistic
+        // change that may yet be undone.
+        static constexpr quint32 SnapshotMagic = 0x41465753; // "AFWS"
+        static constexpr quint32 SnapshotVersion = 2;
+        static constexpr int SnapshotInterval = 60000;
+        QThreadPool snapshotWriter;
+        QTimer *snapshotTimer;
+        QString snapshotPath();
+        bool loadSnapshot();
+        void saveSnapshot();
+        void flushSnapshot();
+        void writeSnapshot(const QByteArray &data);
+        static void writeSnapshotFile(const QString &path, const QByteArray &data);
+        static QByteArray serializeSnapshot(const TreeCache &tree, const map<string, string> &transactionIds);
+        static void writeSnapshotNodes(QDataStream &out, const TreeCache &tree, uint32_t parent);
+        static bool readSnapshotNodes(QDataStream &in, TreeCache &tree, uint32_t parent, int depth);
         std::chrono::steady_clock::time_point lastFetched;
         void refreshCachedTree();
-        void updateCachedTree(NodeAction action, const json &NodeInfo, function<void(bool)> callback);
+        void updateCachedTree(NodeAction action, const json &NodeInfo, function<void(bool success, JournalEntry &&journal)> callback);
         
+        // Where the CLI is and the environment to run it in, found once off the GUI thread and remembered in the
+        // plugin settings (cli/path, cli/searchPath) for the next launch. Commands issued before then wait for it.
         QString CLIPath;
-        string findCLI();
-        string html_to_text(const string& in);
-        QString applyStrikethrough(const QString &text);
-        void runWorkflowyCommand(const QStringList &args, function<void(bool success, const json &result)> callback);
+        QProcessEnvironment cliEnvironment;
+        QString nodePath = QStringLiteral("node");
+        bool resolvingCLI = false;
+        vector<function<void()>> waitingForCLI;
+        QThreadPool cliResolver;
+        void resolveCLI();
+        bool loadResolvedCLI();
+        static string findCLI();
+        static QString findNode(const QString &searchPath);
+        void runWorkflowyCommand(const QStringList &args, function<void(bool success, const json &result)> callback, int timeout = CliWorker::RequestTimeout);
+        void spawnWorkflowyCommand(const QStringList &args, function<void(bool success, const json &result)> callback);
+        bool resolveCommand(const QStringList &args, QString &executable, QStringList &processArgs);
+        static QProcessEnvironment commandEnvironment();
+
+        // Persistent `workflowy serve` process answering requests by id.
+        // Declared last so its reply thread is torn down before anything a reply handler touches.
+        using ReplyHandler = CliWorker::TreeReplyHandler;
+        void runWorkflowyCommandOffThread(const QStringList &args, ReplyHandler handler, int timeout = CliWorker::RequestTimeout);
+        bool startWorker();
+        CliWorker worker{this};
 };